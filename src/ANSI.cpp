@@ -0,0 +1,381 @@
+#include "ANSI.hpp"
+#include <cstring>
+#include <algorithm>
+
+using namespace ANSI;
+
+static constexpr char ESC = '\x1b';
+static constexpr char BEL = '\x07';
+
+////////////////////////////////////////////////
+/// \brief Get a color that is not mistaken for the default color
+///
+/// \param rgb The color in 24 bit RGB
+/// \returns rgb, with black as 0x000001
+////////////////////////////////////////////////
+static Color trueColor(std::uint32_t rgb)
+{
+	return Color(rgb == 0 ? 1 : rgb);
+}
+
+////////////////////////////////////////////////
+/// \brief Read a number of an SGR sequence
+///
+/// \param s The parameter, consumed up to the next separator
+/// \returns The number, 0 if empty
+////////////////////////////////////////////////
+static std::uint32_t parseNumber(std::string_view& s)
+{
+	std::uint32_t n = 0;
+	std::size_t i = 0;
+	for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; ++i)
+		n = std::min<std::uint32_t>(n * 10 + (s[i] - '0'), 0xFFFF);
+	s.remove_prefix(i);
+	return n;
+}
+
+////////////////////////////////////////////////
+/// \brief Read an extended color, after 38 or 48
+///
+/// Accepts `5;n` and `2;r;g;b`, or the `:` separated forms `5:n`
+/// and `2:[colorspace]:r:g:b`.
+/// \param params The parameters, starting after the 38 or 48 group
+/// \param sub The remaining subparameters of the group, after `38:`
+/// \returns The color, if valid
+////////////////////////////////////////////////
+static std::optional<Color> parseExtendedColor(std::string_view& params, std::string_view sub)
+{
+	std::uint32_t v[5];
+	std::size_t n = 0;
+
+	if (!sub.empty()) // Subparameters: everything is in this group
+	{
+		while (!sub.empty() && n < 5)
+		{
+			v[n++] = parseNumber(sub);
+			if (!sub.empty())
+				sub.remove_prefix(1); // ':'
+		}
+
+		if (n >= 2 && v[0] == 5)
+			return Color::Palette(static_cast<std::uint8_t>(v[1]));
+		else if (n == 4 && v[0] == 2)
+			return trueColor((v[1] & 0xFF) << 16 | (v[2] & 0xFF) << 8 | (v[3] & 0xFF));
+		else if (n == 5 && v[0] == 2)
+			return trueColor((v[2] & 0xFF) << 16 | (v[3] & 0xFF) << 8 | (v[4] & 0xFF));
+		return {};
+	}
+
+	// Legacy form, the values are the next groups
+	const auto next = [&]() -> std::optional<std::uint32_t>
+	{
+		if (params.empty())
+			return {};
+		const std::uint32_t x = parseNumber(params);
+		if (!params.empty())
+			params.remove_prefix(1); // ';'
+		return x;
+	};
+
+	const auto type = next();
+	if (type == 5u)
+	{
+		if (const auto index = next(); index)
+			return Color::Palette(static_cast<std::uint8_t>(*index));
+	}
+	else if (type == 2u)
+	{
+		const auto r = next(), g = next(), b = next();
+		if (r && g && b)
+			return trueColor((*r & 0xFF) << 16 | (*g & 0xFF) << 8 | (*b & 0xFF));
+	}
+	return {};
+}
+
+void Parser::applySGR(std::string_view params)
+{
+	const auto set = [this](TextStyle flag)
+	{
+		m_style.s = TextStyle(static_cast<int>(m_style.s) | static_cast<int>(flag));
+	};
+	const auto clear = [this](TextStyle flag)
+	{
+		m_style.s = TextStyle(static_cast<int>(m_style.s) & ~static_cast<int>(flag));
+	};
+
+	if (params.empty()) // `ESC [ m`
+	{
+		m_style = m_base;
+		return;
+	}
+
+	while (!params.empty())
+	{
+		// Split the group and its subparameters
+		const std::size_t end = std::min(params.find(';'), params.size());
+		std::string_view group = params.substr(0, end);
+		params.remove_prefix(std::min(end + 1, params.size()));
+
+		const std::uint32_t code = parseNumber(group);
+		std::string_view sub;
+		if (!group.empty() && group[0] == ':')
+			sub = group.substr(1);
+
+		switch (code)
+		{
+			case 0: m_style = m_base; break;
+			case 1: set(TextStyle::Bold); break;
+			case 3: set(TextStyle::Italic); break;
+			case 4:
+				// `4:0` disables underline, other styles (`4:3` curly...) are drawn as underline
+				if (!sub.empty() && sub[0] == '0')
+					clear(TextStyle::Underline);
+				else
+					set(TextStyle::Underline);
+				break;
+			case 7: set(TextStyle::Reverse); break;
+			case 9: set(TextStyle::Strike); break;
+			case 21: set(TextStyle::Underline); break; // Double underline
+			case 22: clear(TextStyle::Bold); break;
+			case 23: clear(TextStyle::Italic); break;
+			case 24: clear(TextStyle::Underline); break;
+			case 27: clear(TextStyle::Reverse); break;
+			case 29: clear(TextStyle::Strike); break;
+			case 39: m_style.fg = m_base.fg; break;
+			case 49: m_style.bg = m_base.bg; break;
+			case 38:
+				if (const auto c = parseExtendedColor(params, sub); c)
+					m_style.fg = *c;
+				break;
+			case 48:
+				if (const auto c = parseExtendedColor(params, sub); c)
+					m_style.bg = *c;
+				break;
+			case 58: // Underline color, not supported: consume its values
+				parseExtendedColor(params, sub);
+				break;
+			default:
+				if (code >= 30 && code <= 37)
+					m_style.fg = Color::Palette(code - 30);
+				else if (code >= 40 && code <= 47)
+					m_style.bg = Color::Palette(code - 40);
+				else if (code >= 90 && code <= 97)
+					m_style.fg = Color::Palette(code - 90 + 8);
+				else if (code >= 100 && code <= 107)
+					m_style.bg = Color::Palette(code - 100 + 8);
+				break;
+		}
+	}
+}
+
+template <class Sink>
+void Parser::feed(std::string_view in, Sink&& sink)
+{
+	const char* p = in.data();
+	const char* const end = p + in.size();
+
+	while (p != end)
+	{
+		switch (m_state)
+		{
+			case State::Text:
+			{
+				const char* esc = static_cast<const char*>(std::memchr(p, ESC, end - p));
+				if (!esc)
+				{
+					sink(std::string_view(p, end - p), false);
+					return;
+				}
+				if (esc != p)
+					sink(std::string_view(p, esc - p), false);
+				// An escape ends any incomplete UTF-8 sequence, which keeps the previous style
+				sink(std::string_view(), true);
+				m_state = State::Escape;
+				p = esc + 1;
+				break;
+			}
+			case State::Escape:
+			{
+				const char c = *p++;
+				if (c == '[')
+				{
+					m_state = State::CSI;
+					m_sequenceSize = 0;
+				}
+				else if (c == ']' || c == 'P' || c == '_' || c == '^' || c == 'X')
+					m_state = State::ControlString;
+				else if (c >= 0x20 && c <= 0x2F)
+					m_state = State::EscapeIntermediate;
+				else if (c != ESC)
+					m_state = State::Text;
+				break;
+			}
+			case State::EscapeIntermediate:
+			{
+				const char c = *p++;
+				if (c == ESC)
+					m_state = State::Escape;
+				else if (c < 0x20 || c > 0x2F)
+					m_state = State::Text;
+				break;
+			}
+			case State::CSI:
+			{
+				// Parameter and intermediate bytes
+				const char* stop = p;
+				while (stop != end && *stop >= 0x20 && *stop <= 0x3F)
+					++stop;
+
+				std::string_view params(p, stop - p);
+				const bool complete = stop != end && *stop >= 0x40 && *stop <= 0x7E;
+				if (m_sequenceSize != 0 || !complete)
+				{
+					// Split between chunks or by a control character, the sequence is kept. Past the limit,
+					// only the size is kept so that the sequence is ignored
+					if (m_sequenceSize < s_maxSequence)
+					{
+						const std::size_t n = std::min(params.size(), s_maxSequence - m_sequenceSize);
+						std::copy_n(p, n, m_sequence.data() + m_sequenceSize);
+					}
+					m_sequenceSize += params.size();
+					params = std::string_view(m_sequence.data(), std::min(m_sequenceSize, s_maxSequence));
+				}
+				p = stop;
+				if (p == end)
+					return;
+
+				const char c = *p++;
+				if (c >= 0x40 && c <= 0x7E) // Final byte
+				{
+					m_state = State::Text;
+					// Private sequences (`ESC [ > 4 m`...) and intermediate bytes are not SGR
+					if (c == 'm' && std::max(m_sequenceSize, params.size()) <= s_maxSequence &&
+						std::all_of(params.begin(), params.end(), [](char b) { return b >= '0' && b <= ';'; }))
+						applySGR(params);
+				}
+				else if (c == ESC)
+					m_state = State::Escape;
+				else if (c == 0x18 || c == 0x1A) // CAN and SUB abort the sequence
+					m_state = State::Text;
+				// Other control characters are executed by terminals, they are ignored here
+				break;
+			}
+			case State::ControlString:
+			{
+				const char* stop = p;
+				while (stop != end && *stop != BEL && *stop != ESC)
+					++stop;
+				if (stop == end)
+					return;
+				m_state = *stop == BEL ? State::Text : State::ControlStringEscape;
+				p = stop + 1;
+				break;
+			}
+			case State::ControlStringEscape:
+			{
+				if (*p == '\\') // String terminator
+				{
+					m_state = State::Text;
+					++p;
+				}
+				else // Any other sequence aborts the string
+					m_state = State::Escape;
+				break;
+			}
+		}
+	}
+}
+
+Parser::Parser(const TBStyle& base, UTF8::Mode mode):
+	m_base(base), m_style(base), m_decoder(mode)
+{
+}
+
+void Parser::Feed(std::string_view in, TBStringBuilder& out)
+{
+	feed(in, [&](std::string_view bytes, bool flush)
+	{
+		m_text.clear();
+		if (flush)
+			m_decoder.Finish(m_text);
+		else
+			m_decoder.Decode(bytes, m_text);
+		if (!m_text.empty())
+			out.Append(m_text, m_style);
+	});
+}
+
+////////////////////////////////////////////////
+/// \brief Append text to spans
+///
+/// \param spans The spans
+/// \param beg The index of the text
+/// \param size The size of the text
+/// \param style The style of the text
+////////////////////////////////////////////////
+static void appendSpan(std::vector<Span>& spans, std::size_t beg, std::size_t size, const TBStyle& style)
+{
+	if (size == 0)
+		return;
+
+	if (!spans.empty())
+	{
+		Span& last = spans.back();
+		if (last.beg + last.size == beg && last.style.fg() == style.fg() && last.style.bg() == style.bg() && last.style.s == style.s)
+		{
+			last.size += size;
+			return;
+		}
+	}
+	spans.push_back({ beg, size, style });
+}
+
+void Parser::Feed(std::string_view in, String& text, std::vector<Span>& spans)
+{
+	feed(in, [&](std::string_view bytes, bool flush)
+	{
+		const std::size_t beg = text.size();
+		if (flush)
+			m_decoder.Finish(text);
+		else
+			m_decoder.Decode(bytes, text);
+		appendSpan(spans, beg, text.size() - beg, m_style);
+	});
+}
+
+void Parser::Finish(TBStringBuilder& out)
+{
+	m_text.clear();
+	m_decoder.Finish(m_text);
+	if (!m_text.empty())
+		out.Append(m_text, m_style);
+
+	m_state = State::Text;
+	m_sequenceSize = 0;
+	m_style = m_base;
+}
+
+void Parser::Finish(String& text, std::vector<Span>& spans)
+{
+	const std::size_t beg = text.size();
+	m_decoder.Finish(text);
+	appendSpan(spans, beg, text.size() - beg, m_style);
+
+	m_state = State::Text;
+	m_sequenceSize = 0;
+	m_style = m_base;
+}
+
+const TBStyle& Parser::GetStyle() const
+{
+	return m_style;
+}
+
+TBString ANSI::Parse(std::string_view in, const TBStyle& base)
+{
+	Parser parser(base);
+	TBStringBuilder out(in.size());
+	parser.Feed(in, out);
+	parser.Finish(out);
+	return out.Build();
+}
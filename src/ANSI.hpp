@@ -0,0 +1,137 @@
+#ifndef TERMBOXWIDGETS_ANSI_HPP
+#define TERMBOXWIDGETS_ANSI_HPP
+
+#include "Text.hpp"
+#include "UTF8.hpp"
+#include <vector>
+
+////////////////////////////////////////////////
+/// \brief Styled text from ANSI escape sequences
+///
+/// Converts the output of programs that color their output with
+/// SGR sequences (`ESC [ ... m`) into styled text. 8, 16, 256 colors and
+/// 24 bit colors are supported, as well as bold, italic, underline,
+/// reverse and strike. Other escape sequences are removed.
+/// \code{.cpp}
+/// ANSI::Parser parser(Settings::default_text_style);
+/// TBStringBuilder log;
+/// while ((n = read(fd, buf, sizeof(buf))) > 0)
+/// 	parser.Feed(std::string_view(buf, n), log);
+/// parser.Finish(log);
+/// \endcode
+/// \ingroup Records
+////////////////////////////////////////////////
+namespace ANSI
+{
+////////////////////////////////////////////////
+/// \brief Run of text with the same style
+////////////////////////////////////////////////
+struct Span
+{
+	std::size_t beg; ///< Index of the first codepoint
+	std::size_t size; ///< Number of codepoints
+	TBStyle style;
+};
+
+////////////////////////////////////////////////
+/// \brief Streaming parser
+///
+/// The input can be given in chunks of any size: escape and UTF-8
+/// sequences split between two chunks are kept until they are complete.
+/// The parser does not allocate, except to grow its output.
+////////////////////////////////////////////////
+class Parser
+{
+	enum class State : std::uint8_t
+	{
+		Text,
+		Escape, ///< After ESC
+		EscapeIntermediate, ///< After ESC and intermediate bytes, e.g `ESC (`
+		CSI, ///< After `ESC [`
+		ControlString, ///< Inside an OSC, DCS, APC, PM or SOS string
+		ControlStringEscape, ///< After ESC inside a control string
+	};
+
+	////////////////////////////////////////////////
+	/// \brief Maximum length of the parameters of a CSI sequence
+	///
+	/// Longer sequences are ignored
+	////////////////////////////////////////////////
+	static constexpr std::size_t s_maxSequence = 128;
+
+	TBStyle m_base;
+	TBStyle m_style;
+	UTF8::Decoder m_decoder;
+	State m_state = State::Text;
+	std::array<char, s_maxSequence> m_sequence;
+	std::size_t m_sequenceSize = 0;
+	String m_text; ///< Decoded text, kept to reuse its memory
+
+	template <class Sink>
+	void feed(std::string_view in, Sink&& sink);
+	void applySGR(std::string_view params);
+
+public:
+	////////////////////////////////////////////////
+	/// \brief Constructor
+	///
+	/// \param base The style of text without attributes, restored by `ESC [ 0 m`
+	/// \param mode What to do with invalid UTF-8
+	////////////////////////////////////////////////
+	explicit Parser(const TBStyle& base, UTF8::Mode mode = UTF8::Mode::Lossy);
+
+	////////////////////////////////////////////////
+	/// \brief Parse a chunk
+	///
+	/// \param in The next bytes of the input
+	/// \param out The builder the styled text is appended to
+	////////////////////////////////////////////////
+	void Feed(std::string_view in, TBStringBuilder& out);
+
+	////////////////////////////////////////////////
+	/// \brief Parse a chunk
+	///
+	/// \param in The next bytes of the input
+	/// \param text The string the text is appended to
+	/// \param spans The spans of text, appended to. The last span is
+	///  extended when its style continues.
+	////////////////////////////////////////////////
+	void Feed(std::string_view in, String& text, std::vector<Span>& spans);
+
+	////////////////////////////////////////////////
+	/// \brief Signal the end of the input
+	///
+	/// An incomplete escape sequence is dropped, and the style
+	/// is reset so that the parser can be used again.
+	/// \param out The builder the end of the text is appended to
+	////////////////////////////////////////////////
+	void Finish(TBStringBuilder& out);
+
+	////////////////////////////////////////////////
+	/// \brief Signal the end of the input
+	///
+	/// \param text The string the end of the text is appended to
+	/// \param spans The spans of text, appended to
+	/// \see Finish(TBStringBuilder&)
+	////////////////////////////////////////////////
+	void Finish(String& text, std::vector<Span>& spans);
+
+	////////////////////////////////////////////////
+	/// \brief Get the current style
+	///
+	/// \returns The style of the next text
+	////////////////////////////////////////////////
+	const TBStyle& GetStyle() const;
+};
+
+////////////////////////////////////////////////
+/// \brief Parse text
+///
+/// \param in The text, with escape sequences
+/// \param base The style of text without attributes
+/// \returns The styled text
+////////////////////////////////////////////////
+TBString Parse(std::string_view in, const TBStyle& base);
+} // ANSI
+
+#endif // TERMBOXWIDGETS_ANSI_HPP
@@ -0,0 +1,128 @@
+#include "Cells.hpp"
+#include <algorithm>
+#include <bit>
+
+// Cells are compared and copied as three words
+static_assert(sizeof(struct tb_cell) == 3 * sizeof(std::uint32_t));
+
+void Cells::Fill(struct tb_cell* cells, std::size_t n, const struct tb_cell& cell)
+{
+	const struct tb_cell c = cell;
+
+	#pragma omp parallel for simd if(n >= parallel_threshold)
+	for (std::size_t i = 0; i < n; ++i)
+		cells[i] = c;
+}
+
+void Cells::FillMasked(struct tb_cell* cells, std::size_t n, const struct tb_cell& cell, const std::uint64_t* mask)
+{
+	const struct tb_cell c = cell;
+	const std::size_t words = BitmapWords(n);
+
+	#pragma omp parallel for if(n >= parallel_threshold)
+	for (std::size_t w = 0; w < words; ++w)
+	{
+		const std::uint64_t bits = mask[w];
+		if (!bits)
+			continue;
+
+		struct tb_cell* block = cells + w * 64;
+		const std::size_t count = std::min<std::size_t>(64, n - w * 64);
+		// Full words are the common case, they do not need a test per cell
+		if (bits == ~std::uint64_t(0))
+		{
+			#pragma omp simd
+			for (std::size_t i = 0; i < count; ++i)
+				block[i] = c;
+			continue;
+		}
+
+		#pragma omp simd
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const bool set = (bits >> i) & 1;
+			block[i].ch = set ? c.ch : block[i].ch;
+			block[i].fg = set ? c.fg : block[i].fg;
+			block[i].bg = set ? c.bg : block[i].bg;
+		}
+	}
+}
+
+std::size_t Cells::Compare(const struct tb_cell* a, const struct tb_cell* b, std::size_t n, std::uint64_t* bitmap)
+{
+	const std::size_t words = BitmapWords(n);
+	std::size_t count = 0;
+
+	#pragma omp parallel for reduction(+:count) if(n >= parallel_threshold)
+	for (std::size_t w = 0; w < words; ++w)
+	{
+		const std::size_t beg = w * 64;
+		const std::size_t len = std::min<std::size_t>(64, n - beg);
+		std::uint64_t bits = 0;
+
+		#pragma omp simd reduction(|:bits)
+		for (std::size_t i = 0; i < len; ++i)
+		{
+			const std::uint32_t diff =
+				(a[beg + i].ch ^ b[beg + i].ch) |
+				(a[beg + i].fg ^ b[beg + i].fg) |
+				(a[beg + i].bg ^ b[beg + i].bg);
+			bits |= std::uint64_t(diff != 0) << i;
+		}
+
+		bitmap[w] = bits;
+		count += std::popcount(bits);
+	}
+
+	return count;
+}
+
+void Cells::Remap(struct tb_cell* cells, std::size_t n, const std::uint8_t* lut, int bits)
+{
+	const int shift = 8 - bits;
+	const std::uint32_t mask = (1 << bits) - 1;
+	const auto remap = [=](std::uint32_t c) -> std::uint32_t
+	{
+		const std::uint32_t rgb = c & 0xFFFFFF;
+		const std::uint32_t index =
+			((rgb >> (16 + shift)) & mask) << (2 * bits) |
+			((rgb >> (8 + shift)) & mask) << bits |
+			((rgb >> shift) & mask);
+		// Keep the attributes stored in the upper byte
+		return rgb == (TB_DEFAULT & 0xFFFFFF) ? c : (c & 0xFF000000) | lut[index];
+	};
+
+	#pragma omp parallel for simd if(n >= parallel_threshold)
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		cells[i].fg = remap(cells[i].fg);
+		cells[i].bg = remap(cells[i].bg);
+	}
+}
+
+void Cells::Blend(struct tb_cell* cells, std::size_t n, std::uint32_t color, std::uint8_t alpha, std::uint32_t fgDefault, std::uint32_t bgDefault)
+{
+	const std::uint32_t a = alpha;
+	const std::uint32_t r = ((color >> 16) & 0xFF) * a;
+	const std::uint32_t g = ((color >> 8) & 0xFF) * a;
+	const std::uint32_t b = (color & 0xFF) * a;
+	const auto blend = [=](std::uint32_t c, std::uint32_t def) -> std::uint32_t
+	{
+		const std::uint32_t rgb = (c & 0xFFFFFF) == (TB_DEFAULT & 0xFFFFFF) ? def : c;
+		// x / 255, rounded, for x in [0, 255 * 255]
+		const auto div255 = [](std::uint32_t x) { return (x + 128 + ((x + 128) >> 8)) >> 8; };
+		const std::uint32_t blended =
+			div255(((rgb >> 16) & 0xFF) * (255 - a) + r) << 16 |
+			div255(((rgb >> 8) & 0xFF) * (255 - a) + g) << 8 |
+			div255((rgb & 0xFF) * (255 - a) + b);
+		// Keep the attributes stored in the upper byte
+		return (c & 0xFF000000) | (blended == (TB_DEFAULT & 0xFFFFFF) ? 1 : blended);
+	};
+
+	#pragma omp parallel for simd if(n >= parallel_threshold)
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		cells[i].fg = blend(cells[i].fg, fgDefault);
+		cells[i].bg = blend(cells[i].bg, bgDefault);
+	}
+}
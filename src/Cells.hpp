@@ -0,0 +1,109 @@
+#ifndef TERMBOXWIDGETS_CELLS_HPP
+#define TERMBOXWIDGETS_CELLS_HPP
+
+#include "termbox/src/termbox.h"
+#include <cstdint>
+#include <cstddef>
+
+////////////////////////////////////////////////
+/// \brief Kernels over arrays of cells
+///
+/// These loops are vectorized, and split across threads
+/// when the array is larger than Cells::parallel_threshold.
+///
+/// Bitmaps hold one bit per cell, bit `i % 64` of word `i / 64`
+/// is the bit of cell `i`. They must hold Cells::BitmapWords(n) words.
+/// \ingroup Records
+////////////////////////////////////////////////
+namespace Cells
+{
+////////////////////////////////////////////////
+/// \brief Number of cells from which the kernels use multiple threads
+////////////////////////////////////////////////
+constexpr std::size_t parallel_threshold = 1 << 16;
+
+////////////////////////////////////////////////
+/// \brief Get the number of words of a bitmap
+///
+/// \param n The number of cells
+/// \returns The number of 64 bit words needed to hold n bits
+////////////////////////////////////////////////
+constexpr std::size_t BitmapWords(std::size_t n)
+{
+	return (n + 63) / 64;
+}
+
+////////////////////////////////////////////////
+/// \brief Test a bit of a bitmap
+///
+/// \param bitmap The bitmap
+/// \param i The index of the cell
+/// \returns True if the bit of cell i is set
+////////////////////////////////////////////////
+constexpr bool Test(const std::uint64_t* bitmap, std::size_t i)
+{
+	return (bitmap[i / 64] >> (i % 64)) & 1;
+}
+
+////////////////////////////////////////////////
+/// \brief Fill cells
+///
+/// \param cells The cells
+/// \param n The number of cells
+/// \param cell The cell to fill with
+////////////////////////////////////////////////
+void Fill(struct tb_cell* cells, std::size_t n, const struct tb_cell& cell);
+
+////////////////////////////////////////////////
+/// \brief Fill the cells whose bit is set
+///
+/// \param cells The cells
+/// \param n The number of cells
+/// \param cell The cell to fill with
+/// \param mask The bitmap of the cells to fill
+////////////////////////////////////////////////
+void FillMasked(struct tb_cell* cells, std::size_t n, const struct tb_cell& cell, const std::uint64_t* mask);
+
+////////////////////////////////////////////////
+/// \brief Compare two arrays of cells
+///
+/// \param a The first cells
+/// \param b The second cells
+/// \param n The number of cells
+/// \param bitmap The bitmap that receives a set bit for every cell that differs,
+///  the bits past n are cleared
+/// \returns The number of cells that differ
+////////////////////////////////////////////////
+std::size_t Compare(const struct tb_cell* a, const struct tb_cell* b, std::size_t n, std::uint64_t* bitmap);
+
+////////////////////////////////////////////////
+/// \brief Remap the colors of cells through a lookup table
+///
+/// The table is indexed by the `bits` upper bits of each channel of the
+/// color (red first). Attributes stored in the upper byte of the colors are
+/// kept, and default colors (TB_DEFAULT) are left unchanged.
+/// \param cells The cells
+/// \param n The number of cells
+/// \param lut The lookup table, of `1 << (3 * bits)` entries
+/// \param bits The number of bits per channel
+////////////////////////////////////////////////
+void Remap(struct tb_cell* cells, std::size_t n, const std::uint8_t* lut, int bits);
+
+////////////////////////////////////////////////
+/// \brief Blend the colors of cells toward a color
+///
+/// Both the foreground and background colors are blended, attributes stored
+/// in the upper byte of the colors are kept.
+/// \param cells The cells
+/// \param n The number of cells
+/// \param color The color to blend toward, in 24 bit RGB
+/// \param alpha The weight of color, from 0 (unchanged) to 255 (replaced)
+/// \param fgDefault The color the default foreground color (TB_DEFAULT) is blended as
+/// \param bgDefault The color the default background color is blended as
+/// \note A blended color that ends up black is stored as 0x000001, since 0
+///  stands for the default color
+////////////////////////////////////////////////
+void Blend(struct tb_cell* cells, std::size_t n, std::uint32_t color, std::uint8_t alpha, std::uint32_t fgDefault, std::uint32_t bgDefault);
+} // Cells
+
+#endif // TERMBOXWIDGETS_CELLS_HPP
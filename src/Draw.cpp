@@ -1,16 +1,347 @@
 #include "Draw.hpp"
 #include "Termbox.hpp"
+#include "Surface.hpp"
+#include "Cells.hpp"
+#include <cstring>
+#include <atomic>
+#include <shared_mutex>
+#include <mutex>
+#include <charconv>
+#include <cmath>
 
-static bool validCoordinates(Vec2i pos)
+// Not a std::pair<Vec2i, Vec2i>: the vector's iterators would find Vec2i's operators through ADL
+struct ClipRect
 {
+	Vec2i pos, size;
+};
+
+struct Translation
+{
+	Vec2i offset;
+};
+
+struct DrawTarget
+{
+	CellSurface* surface; // nullptr for the screen
+	Vec2i screen; // Position of the target's first cell on the screen
+	Vec2i offset; // Added to positions to get the target's coordinates
+	std::vector<Translation> translation; // Previous offsets
+	std::vector<ClipRect> clip; // In the target's coordinates
+};
+// Each thread has its own targets, so that widgets can be drawn concurrently
+static thread_local std::vector<DrawTarget> s_targets(1, DrawTarget{ nullptr, Vec2i(0, 0), Vec2i(0, 0), {}, {} });
+
+static std::pair<Vec2i, Vec2i> intersect(const std::pair<Vec2i, Vec2i>& a, const std::pair<Vec2i, Vec2i>& b)
+{
+	const Vec2i beg(std::max(a.first[0], b.first[0]), std::max(a.first[1], b.first[1]));
+	const Vec2i end(
+		std::min(a.first[0] + a.second[0], b.first[0] + b.second[0]),
+		std::min(a.first[1] + a.second[1], b.first[1] + b.second[1]));
+
+	return { beg, Vec2i(std::max(end[0] - beg[0], 0), std::max(end[1] - beg[1], 0)) };
+}
+
+static DrawTarget& target()
+{
+	return s_targets[s_targets.size() - 1];
+}
+
+// Cells of the current target and its size
+static std::pair<struct tb_cell*, Vec2i> targetBuffer()
+{
+	CellSurface* surface = target().surface;
+	if (!surface)
+		return { tb_cell_buffer(), Vec2i(tb_width(), tb_height()) };
+
+	return { surface->Data(), surface->GetSize() };
+}
+
+// Clipping rectangle in the target's coordinates
+static std::pair<Vec2i, Vec2i> targetClip()
+{
+	// The target may have been resized since the clip was pushed
+	const std::pair<Vec2i, Vec2i> bounds = { Vec2i(0, 0), targetBuffer().second };
+	const auto& clip = target().clip;
+	if (clip.empty())
+		return bounds;
+
+	return intersect({ clip[clip.size() - 1].pos, clip[clip.size() - 1].size }, bounds);
+}
+
+// Cells of the screen covered by the second half of a wide character,
+// surfaces have their own (see CellSurface::WideData)
+static std::vector<std::uint64_t> s_screenWide;
+
+struct WideMap
+{
+	std::uint64_t* bits;
+	std::size_t stride; // Words per row, rows hold w + 1 bits
+};
+
+static void resetScreenWide()
+{
+	const Vec2i dim(std::max(tb_width(), 0), std::max(tb_height(), 0));
+	s_screenWide.assign(Cells::BitmapWords(dim[0] + 1) * dim[1], 0);
+}
+
+static WideMap targetWide()
+{
+	CellSurface* surface = target().surface;
+	if (surface)
+		return { surface->WideData(), Cells::BitmapWords(surface->GetSize()[0] + 1) };
+
+	// Termbox resets it whenever the screen is resized, before anything is drawn
+	const std::size_t stride = Cells::BitmapWords(std::max(tb_width(), 0) + 1);
+	if (s_screenWide.size() != stride * std::max(tb_height(), 0))
+		resetScreenWide();
+	return { s_screenWide.data(), stride };
+}
+
+// Widgets drawn concurrently may share a word of the bitmap, but never a bit
+static bool testBit(std::uint64_t* row, int x)
+{
+	return (std::atomic_ref<std::uint64_t>(row[x / 64]).load(std::memory_order_relaxed) >> (x % 64)) & 1;
+}
+
+// Set bits [beg, end) of a row of a bitmap to bit(x), called in increasing x
+template <class F>
+static void writeBits(std::uint64_t* row, int beg, int end, F&& bit)
+{
+	for (int x = beg; x < end;)
+	{
+		const int word = x / 64;
+		const int last = std::min(end, (word + 1) * 64);
+		std::uint64_t mask = 0, value = 0;
+		for (; x < last; ++x)
+		{
+			mask |= std::uint64_t(1) << (x % 64);
+			value |= std::uint64_t(bit(x)) << (x % 64);
+		}
+
+		std::atomic_ref<std::uint64_t> ref(row[word]);
+		ref.fetch_and(~mask | value, std::memory_order_relaxed);
+		ref.fetch_or(value, std::memory_order_relaxed);
+	}
+}
+
+// Record the wide characters of cells written to the current target,
+// wide(j) is true if cell j of row starts a wide character
+template <class F>
+static void markWide(std::span<const struct tb_cell> row, F&& wide)
+{
+	if (row.empty())
+		return;
+
+	const auto [cells, dim] = targetBuffer();
+	const std::size_t i = row.data() - cells;
+	const int x = i % dim[0];
+	const int y = i / dim[0];
+	const WideMap map = targetWide();
+	// The bit of a cell is set by the cell on its left
+	writeBits(map.bits + y * map.stride, x + 1, x + 1 + static_cast<int>(row.size()),
+		[&](int b) { return wide(b - x - 1); });
+}
+
+// Rectangle of a target whose written cells are recorded, see Draw::Watch
+struct WatchRect
+{
+	const CellSurface* surface; // nullptr for the screen
+	Vec2i origin; // Position of the bitmap's first cell, in the target's coordinates
+	std::size_t stride; // Words per row of the bitmap
+	ClipRect rect; // Recorded cells, in the target's coordinates
+	std::uint64_t* damage;
+};
+// Watches outlive draws and may be added by any thread
+static std::vector<WatchRect> s_watches;
+static std::shared_mutex s_watchMutex;
+static std::atomic<std::size_t> s_watchCount = 0;
+
+// Record a rectangle of the current target as written, in the target's coordinates
+static void damage(Vec2i pos, Vec2i size)
+{
+	if (s_watchCount.load(std::memory_order_relaxed) == 0)
+		return;
+
+	std::shared_lock lock(s_watchMutex);
+	for (const auto& watch : s_watches)
+	{
+		if (watch.surface != target().surface)
+			continue;
+
+		const auto [rpos, rsize] = intersect({ watch.rect.pos, watch.rect.size }, { pos, size });
+		for (int y = rpos[1]; y < rpos[1] + rsize[1]; ++y)
+			writeBits(watch.damage + (y - watch.origin[1]) * watch.stride,
+				rpos[0] - watch.origin[0], rpos[0] + rsize[0] - watch.origin[0], [](int) { return true; });
+	}
+}
+
+void Draw::PushTarget(CellSurface& surface, Vec2i origin)
+{
+	const Vec2i screen = Draw::ToScreen(origin);
+	s_targets.push_back({ &surface, screen, Vec2i(0, 0) - origin, {}, {} });
+}
+
+void Draw::PopTarget()
+{
+	if (s_targets.size() > 1)
+		s_targets.pop_back();
+}
+
+void Draw::PushTranslation(Vec2i offset)
+{
+	target().translation.push_back({ target().offset });
+	target().offset += offset;
+}
+
+void Draw::PopTranslation()
+{
+	auto& translation = target().translation;
+	if (translation.empty())
+		return;
+
+	target().offset = translation[translation.size() - 1].offset;
+	translation.pop_back();
+}
+
+Vec2i Draw::ToScreen(Vec2i pos)
+{
+	return pos + target().offset + target().screen;
+}
+
+void Draw::PushClip(Vec2i pos, Vec2i size)
+{
+	auto& clip = target().clip;
+	pos += target().offset;
+	if (!clip.empty())
+		std::tie(pos, size) = intersect({ clip[clip.size() - 1].pos, clip[clip.size() - 1].size }, { pos, size });
+	clip.push_back({ pos, size });
+}
+
+void Draw::PopClip()
+{
+	auto& clip = target().clip;
+	if (!clip.empty())
+		clip.pop_back();
+}
+
+std::pair<Vec2i, Vec2i> Draw::GetClip()
+{
+	const auto [pos, size] = targetClip();
+	return { pos - target().offset, size };
+}
+
+// Same as Draw::Row, the cells are not recorded as written
+static std::pair<std::span<struct tb_cell>, int> targetRow(Vec2i pos, int w)
+{
+	pos += target().offset;
 	const auto& [x, y] = pos;
+	const auto [cpos, csize] = targetClip();
 
-	if (x < 0 || x >= tb_width())
-		return false;
-	if (y < 0 || y >= tb_height())
+	if (y < cpos[1] || y >= cpos[1] + csize[1])
+		return { {}, 0 };
+
+	const int beg = std::max(x, cpos[0]);
+	const int end = std::min(x + std::max(w, 0), cpos[0] + csize[0]);
+	if (beg >= end)
+		return { {}, 0 };
+
+	const auto [cells, dim] = targetBuffer();
+	return { { cells + beg + y * dim[0], static_cast<std::size_t>(end - beg) }, beg - x };
+}
+
+std::pair<std::span<struct tb_cell>, int> Draw::Row(Vec2i pos, int w)
+{
+	const auto r = targetRow(pos, w);
+	if (!r.first.empty())
+		damage(pos + target().offset + Vec2i(r.second, 0), Vec2i(static_cast<int>(r.first.size()), 1));
+	return r;
+}
+
+std::tuple<struct tb_cell*, int, int, int> Draw::Column(Vec2i pos, int h)
+{
+	pos += target().offset;
+	const auto& [x, y] = pos;
+	const auto [cpos, csize] = targetClip();
+
+	if (x < cpos[0] || x >= cpos[0] + csize[0])
+		return { nullptr, 0, 0, 0 };
+
+	const int beg = std::max(y, cpos[1]);
+	const int end = std::min(y + h, cpos[1] + csize[1]);
+	if (beg >= end)
+		return { nullptr, 0, 0, 0 };
+
+	damage(Vec2i(x, beg), Vec2i(1, end - beg));
+	const auto [cells, dim] = targetBuffer();
+	return { cells + x + beg * dim[0], dim[0], end - beg, beg - y };
+}
+
+void Draw::MarkWide(std::span<const struct tb_cell> row)
+{
+	// The second half of a wide character is not drawn, whatever it holds is covered
+	bool covered = false;
+	markWide(row, [&](int j)
+	{
+		covered = !covered && Grapheme::Width(row[j].ch) > 1;
+		return covered;
+	});
+}
+
+bool Draw::IsContinuation(Vec2i pos)
+{
+	pos += target().offset;
+	const auto& [x, y] = pos;
+	const auto [cells, dim] = targetBuffer();
+	if (x < 0 || y < 0 || x > dim[0] || y >= dim[1])
 		return false;
 
-	return true;
+	const WideMap wide = targetWide();
+	return testBit(wide.bits + y * wide.stride, x);
+}
+
+void Draw::ClearWide()
+{
+	resetScreenWide();
+}
+
+void Draw::Watch(std::uint64_t* damage, Vec2i pos, Vec2i size)
+{
+	pos += target().offset;
+	const auto [rpos, rsize] = intersect(targetClip(), { pos, size });
+	std::unique_lock lock(s_watchMutex);
+	s_watches.push_back({ target().surface, pos, Cells::BitmapWords(std::max(size[0], 0)), { rpos, rsize }, damage });
+	s_watchCount.store(s_watches.size(), std::memory_order_relaxed);
+}
+
+void Draw::Unwatch(const std::uint64_t* damage)
+{
+	std::unique_lock lock(s_watchMutex);
+	std::erase_if(s_watches, [=](const WatchRect& watch) { return watch.damage == damage; });
+	s_watchCount.store(s_watches.size(), std::memory_order_relaxed);
+}
+
+// Fill a row with a (possibly wide) character, continuation cells are filled with spaces
+static void fillRow(std::span<struct tb_cell> row, int off, int w, const struct tb_cell& cell)
+{
+	const int width = std::max(Grapheme::Width(cell.ch), 1);
+	if (width == 1)
+	{
+		Cells::Fill(row.data(), row.size(), cell);
+		markWide(row, [](int) { return false; });
+		return;
+	}
+
+	struct tb_cell blank = cell;
+	blank.ch = U' ';
+	const auto wide = [=](int j) { return !((off + j) % width || off + j + width > w); };
+	// The row is blanked, then the cells where a wide character starts are set
+	thread_local std::vector<std::uint64_t> mask;
+	mask.assign(Cells::BitmapWords(row.size()), 0);
+	for (std::size_t j = 0; j < row.size(); ++j)
+		mask[j / 64] |= std::uint64_t(wide(j)) << (j % 64);
+	Cells::Fill(row.data(), row.size(), blank);
+	Cells::FillMasked(row.data(), row.size(), cell, mask.data());
+	markWide(row, wide);
 }
 
 std::pair<Vec2i, Vec2i> Draw::Border(const std::array<TBChar, 8>& border, Vec2i pos, Vec2i size, Draw::BorderFlag flags)
@@ -60,202 +391,653 @@ std::pair<Vec2i, Vec2i> Draw::Border(const std::array<TBChar, 8>& border, Vec2i
 
 void Draw::Char(const TBChar& c, Vec2i pos)
 {
-	const auto& [x, y] = pos;
-	const auto cell = c();
-	tb_char(x, y, cell.fg, cell.bg, cell.ch);
+	auto [row, off] = Draw::Row(pos, 1);
+	if (!row.empty())
+	{
+		row[0] = c();
+		Draw::MarkWide(row);
+	}
 }
 
 void Draw::Horizontal(const TBChar& c, Vec2i pos, int w)
 {
-	if (!validCoordinates(pos))
-		return;
-
-	const auto& [x, y] = pos;
-	const auto cell = c();
-	const auto width = wcwidth(cell.ch);
-	w = std::max(w, 0);
-
-	for (int i = 0; i < w; ++i)
-		tb_char(x + i, y, cell.fg, cell.bg, (i % width || i + width > w) ? U' ' : cell.ch);
+	auto [row, off] = Draw::Row(pos, w);
+	fillRow(row, off, w, c());
 }
 
 void Draw::Vertical(const TBChar& c, Vec2i pos, int h)
 {
-	const auto& [x, y] = pos;
+	const auto [cells, stride, count, skipped] = Draw::Column(pos, h);
 	const auto cell = c();
-	h = std::max(h, 0);
+	const bool wide = Grapheme::Width(cell.ch) > 1;
 
-	for (int i = 0; i < h; ++i)
-		tb_char(x, y + i, cell.fg, cell.bg, cell.ch);
+	for (int j = 0; j < count; ++j)
+	{
+		cells[j * stride] = cell;
+		markWide({ cells + j * stride, 1 }, [=](int) { return wide; });
+	}
 }
 
 void Draw::Vertical(std::function<struct tb_cell(const struct tb_cell&, Vec2i pos)> charFn, Vec2i pos, int h)
 {
+	Draw::Vertical<const decltype(charFn)&>(charFn, pos, h);
+}
 
-	const auto& [x, y] = pos;
-	if (static_cast<unsigned int>(x) >= static_cast<unsigned int>(tb_width()))
-		return;
-	if (static_cast<unsigned int>(y) >= static_cast<unsigned int>(tb_height()))
-		return;
-	h = std::max(h, 0);
+std::pair<int, std::size_t> Draw::TextLine(const TBString& s, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+{
+	return Draw::TextLineKernel(TBStringSource{ s }, StyleIdentity{}, pos, w, trailing, beg);
+}
+
+std::pair<int, std::size_t> Draw::TextLine(TBStringView s, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+{
+	return Draw::TextLineKernel(TBStringSource{ s }, StyleIdentity{}, pos, w, trailing, beg);
+}
+
+std::pair<int, std::size_t> Draw::TextLine(std::span<const TBChar> s, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+{
+	return Draw::TextLineKernel(TBStringSource{ s }, StyleIdentity{}, pos, w, trailing, beg);
+}
+
+std::pair<int, std::size_t> Draw::TextLineStyle(const TBString& s, TextStyle textstyle, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+{
+	return Draw::TextLineKernel(TBStringSource{ s }, StyleAdd{ textstyle }, pos, w, trailing, beg);
+}
+
+std::pair<int, std::size_t> Draw::TextLineBackground(const TBString& s, Color bg, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+{
+	return Draw::TextLineKernel(TBStringSource{ s }, StyleBackground{ bg }, pos, w, trailing, beg);
+}
+
+std::pair<int, std::size_t> Draw::TextLine(StringView s, const TBStyle& style, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+{
+	return Draw::TextLineKernel(StringSource{ s, style }, StyleIdentity{}, pos, w, trailing, beg);
+}
+
+struct FormatSpec
+{
+	Char fill = U' ';
+	Char align = 0; // '<', '>', '^' or 0 for the default alignment
+	Char sign = U'-';
+	bool alt = false;
+	bool zero = false;
+	int width = 0;
+	int precision = -1;
+	Char type = 0;
+};
+
+// Writes cells one after the other, until the line is full
+class FormatWriter
+{
+	std::span<struct tb_cell> m_row;
+	int m_off;
+	int m_end;
+	int m_w;
+	int m_p = 0;
+	// Drawn cells: [m_first, m_last)
+	int m_first;
+	int m_last;
+	struct tb_cell m_cell;
+
+public:
+	FormatWriter(Vec2i pos, int w, const TBStyle& style):
+		m_w(w), m_cell(TBChar(U' ', style)())
+	{
+		std::tie(m_row, m_off) = Draw::Row(pos, w);
+		m_end = m_off + static_cast<int>(m_row.size());
+		m_first = m_end;
+		m_last = m_off;
+	}
+
+	bool Full() const
+	{
+		return m_p >= m_w;
+	}
+
+	void Put(Char c)
+	{
+		const int size = std::max(Grapheme::Width(c), 0);
+		if (m_p + size > m_w)
+		{
+			m_p = m_w;
+			return;
+		}
+		if (m_p >= m_off && m_p + std::max(size, 1) <= m_end)
+		{
+			m_row[m_p - m_off] = m_cell;
+			m_row[m_p - m_off].ch = c;
+			m_first = std::min(m_first, m_p);
+			m_last = m_p + std::max(size, 1);
+		}
+		m_p += size;
+	}
 
-	for (int i = 0; i < h; ++i)
+	void Put(std::string_view s)
 	{
-		Vec2i p = { x, y + i };
-		auto cell = charFn(Termbox::At(p), p);
-		tb_cell(x, y + i, &cell);
+		for (const char c : s)
+			Put(static_cast<Char>(c));
 	}
+
+	// Puts the clusters of s ending before end
+	void Put(StringView s, std::size_t end)
+	{
+		for (std::size_t i = 0; i < end && !Full();)
+		{
+			const std::size_t j = Grapheme::Next(s, i);
+			Put(Grapheme::Intern(s.substr(i, j - i)));
+			i = j;
+		}
+	}
+
+	// Pads with c over width cells
+	void Pad(Char c, int width)
+	{
+		const int size = std::max(Grapheme::Width(c), 1);
+		for (int i = 0; i + size <= width && !Full(); i += size)
+			Put(c);
+	}
+
+	int Finish()
+	{
+		if (m_first < m_last)
+			Draw::MarkWide(m_row.subspan(m_first - m_off, m_last - m_first));
+		return m_p;
+	}
+};
+
+static int formatInt(StringView fmt, std::size_t& i)
+{
+	int n = 0;
+	while (i < fmt.size() && fmt[i] >= U'0' && fmt[i] <= U'9')
+	{
+		if (n > (std::numeric_limits<int>::max() - 9) / 10)
+			throw Util::Exception("Format: number too large in format");
+		n = n * 10 + static_cast<int>(fmt[i] - U'0');
+		++i;
+	}
+	return n;
 }
 
-std::pair<int, std::size_t> Draw::TextLine(const TBString& s, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+// Index of the argument of a replacement field, either automatic or manual
+class FormatIndex
 {
-	if (s.Size() == 0)
-		return {0 , beg};
-	const auto& [x, y] = pos;
-	std::size_t i = beg;
-	int p = 0;
+	std::size_t m_next = 0;
+	int m_mode = 0; // 1 when automatic, 2 when manual
 
-	do
+public:
+	std::size_t Get(StringView fmt, std::size_t& i, std::size_t size)
 	{
-		const auto cell = s[i]();
-		int glyph_size = wcwidth(cell.ch);
-		if (p + glyph_size > w)
+		std::size_t index;
+		if (i < fmt.size() && fmt[i] >= U'0' && fmt[i] <= U'9')
 		{
-			if (trailing.ch == U'\0')
-				break;
-			const auto cell = trailing();
-			if (i != 0)
-				p -= wcwidth(s[i - 1].ch);
-			tb_cell(x + p, y, &cell);
-			++p;
-			break;
+			if (m_mode == 1)
+				throw Util::Exception("Format: cannot switch from automatic to manual argument indexing");
+			m_mode = 2;
+			index = static_cast<std::size_t>(formatInt(fmt, i));
 		}
-		tb_cell(x + p, y, &cell);
-		p += glyph_size;
-	} while (++i < s.Size());
+		else
+		{
+			if (m_mode == 2)
+				throw Util::Exception("Format: cannot switch from manual to automatic argument indexing");
+			m_mode = 1;
+			index = m_next++;
+		}
+		if (index >= size)
+			throw Util::Exception("Format: argument index out of range");
+		return index;
+	}
+};
 
-	return { p, i };
+// Width or precision, given in the format or by an argument
+static int formatCount(StringView fmt, std::size_t& i, std::span<const Draw::FormatArg> args, FormatIndex& index)
+{
+	if (i >= fmt.size() || fmt[i] != U'{')
+		return formatInt(fmt, i);
+
+	const Draw::FormatArg& arg = args[index.Get(fmt, ++i, args.size())];
+	if (i >= fmt.size() || fmt[i] != U'}')
+		throw Util::Exception("Format: expected '}' after a nested argument");
+	++i;
+	if (arg.type == Draw::FormatArg::Type::Int && arg.i >= 0 && arg.i <= std::numeric_limits<int>::max())
+		return static_cast<int>(arg.i);
+	if (arg.type == Draw::FormatArg::Type::UInt && arg.u <= static_cast<unsigned long long>(std::numeric_limits<int>::max()))
+		return static_cast<int>(arg.u);
+	throw Util::Exception("Format: width and precision must be non-negative integers");
 }
 
-std::pair<int, std::size_t> Draw::TextLineStyle(const TBString& s, TextStyle textstyle, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+static FormatSpec formatSpec(StringView fmt, std::size_t& i, std::span<const Draw::FormatArg> args, FormatIndex& index)
 {
-	if (s.Size() == 0)
-		return {0 , beg};
-	const auto& [x, y] = pos;
-	std::size_t i = beg;
-	int p = 0;
+	FormatSpec spec;
+	const auto isAlign = [](Char c) { return c == U'<' || c == U'>' || c == U'^'; };
 
-	do
+	if (i + 1 < fmt.size() && isAlign(fmt[i + 1]) && fmt[i] != U'{' && fmt[i] != U'}')
 	{
-		TBChar tbc = s[i];
-		tbc.s.s = static_cast<std::uint32_t>(tbc.s.s) | textstyle;
-		const auto cell = tbc();
-		int glyph_size = wcwidth(cell.ch);
-		if (p + glyph_size > w)
-		{
-			if (trailing.ch == U'\0')
-				break;
-			const auto cell = trailing();
-			if (i != 0)
-				p -= wcwidth(s[i - 1].ch);
-			tb_cell(x + p, y, &cell);
-			++p;
+		spec.fill = fmt[i];
+		spec.align = fmt[i + 1];
+		i += 2;
+	}
+	else if (i < fmt.size() && isAlign(fmt[i]))
+		spec.align = fmt[i++];
+	if (i < fmt.size() && (fmt[i] == U'+' || fmt[i] == U'-' || fmt[i] == U' '))
+		spec.sign = fmt[i++];
+	if (i < fmt.size() && fmt[i] == U'#')
+	{
+		spec.alt = true;
+		++i;
+	}
+	if (i < fmt.size() && fmt[i] == U'0')
+	{
+		spec.zero = true;
+		++i;
+	}
+	spec.width = formatCount(fmt, i, args, index);
+	if (i < fmt.size() && fmt[i] == U'.')
+		spec.precision = formatCount(fmt, ++i, args, index);
+	if (i < fmt.size() && fmt[i] == U'L')
+		++i;
+	if (i < fmt.size() && fmt[i] != U'}')
+		spec.type = fmt[i++];
+	if (i >= fmt.size() || fmt[i] != U'}')
+		throw Util::Exception("Format: invalid format specification");
+	return spec;
+}
+
+// Writes the sign, the prefix and the digits of a number, padded to the width
+static void formatNumber(FormatWriter& out, const FormatSpec& spec, bool negative, std::string_view prefix, std::string_view digits)
+{
+	const char sign = negative ? '-' : spec.sign == U'+' ? '+' : spec.sign == U' ' ? ' ' : '\0';
+	const int size = static_cast<int>((sign ? 1 : 0) + prefix.size() + digits.size());
+	const int pad = std::max(spec.width - size, 0);
+
+	// Zeros go between the prefix and the digits, unless an alignment is given
+	if (spec.zero && !spec.align)
+	{
+		if (sign)
+			out.Put(static_cast<Char>(sign));
+		out.Put(prefix);
+		out.Pad(U'0', pad);
+		out.Put(digits);
+		return;
+	}
+
+	const Char align = spec.align ? spec.align : U'>';
+	const int left = align == U'>' ? pad : align == U'^' ? pad / 2 : 0;
+	out.Pad(spec.fill, left);
+	if (sign)
+		out.Put(static_cast<Char>(sign));
+	out.Put(prefix);
+	out.Put(digits);
+	out.Pad(spec.fill, pad - left);
+}
+
+static void formatInteger(FormatWriter& out, const FormatSpec& spec, unsigned long long magnitude, bool negative)
+{
+	int base = 10;
+	std::string_view prefix;
+	switch (spec.type)
+	{
+		case 0: case U'd': break;
+		case U'b': base = 2; prefix = "0b"; break;
+		case U'B': base = 2; prefix = "0B"; break;
+		case U'o': base = 8; prefix = "0"; break;
+		case U'x': base = 16; prefix = "0x"; break;
+		case U'X': base = 16; prefix = "0X"; break;
+		default: throw Util::Exception("Format: invalid type for an integer");
+	}
+	if (!spec.alt || (base == 8 && magnitude == 0))
+		prefix = {};
+
+	char buf[std::numeric_limits<unsigned long long>::digits];
+	char* end = std::to_chars(buf, buf + sizeof(buf), magnitude, base).ptr;
+	if (spec.type == U'X')
+		std::transform(buf, end, buf, [](char c) { return static_cast<char>(std::toupper(c)); });
+	formatNumber(out, spec, negative, prefix, std::string_view(buf, end - buf));
+}
+
+static void formatFloat(FormatWriter& out, const FormatSpec& spec, double f)
+{
+	char buf[512];
+	std::to_chars_result res;
+	const double abs = std::fabs(f);
+	const int precision = spec.precision;
+	switch (spec.type)
+	{
+		case 0:
+			res = precision < 0
+				? std::to_chars(buf, buf + sizeof(buf), abs)
+				: std::to_chars(buf, buf + sizeof(buf), abs, std::chars_format::general, precision);
 			break;
-		}
-		tb_cell(x + p, y, &cell);
-		p += glyph_size;
-	} while (++i < s.Size());
+		case U'f': case U'F':
+			res = std::to_chars(buf, buf + sizeof(buf), abs, std::chars_format::fixed, precision < 0 ? 6 : precision);
+			break;
+		case U'e': case U'E':
+			res = std::to_chars(buf, buf + sizeof(buf), abs, std::chars_format::scientific, precision < 0 ? 6 : precision);
+			break;
+		case U'g': case U'G':
+			res = std::to_chars(buf, buf + sizeof(buf), abs, std::chars_format::general, precision < 0 ? 6 : precision);
+			break;
+		case U'a': case U'A':
+			res = precision < 0
+				? std::to_chars(buf, buf + sizeof(buf), abs, std::chars_format::hex)
+				: std::to_chars(buf, buf + sizeof(buf), abs, std::chars_format::hex, precision);
+			break;
+		default:
+			throw Util::Exception("Format: invalid type for a float");
+	}
+	if (res.ec != std::errc())
+		throw Util::Exception("Format: float too long");
 
-	return { p, i };
+	if (spec.type == U'F' || spec.type == U'E' || spec.type == U'G' || spec.type == U'A')
+		std::transform(buf, res.ptr, buf, [](char c) { return static_cast<char>(std::toupper(c)); });
+	FormatSpec s = spec;
+	// Infinity and NaN are not padded with zeros
+	if (!std::isfinite(f))
+		s.zero = false;
+	formatNumber(out, s, std::signbit(f), {}, std::string_view(buf, res.ptr - buf));
 }
 
-std::pair<int, std::size_t> Draw::TextLineBackground(const TBString& s, Color bg, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+// Writes the clusters of s, up to precision cells, padded to the width
+static void formatString(FormatWriter& out, const FormatSpec& spec, StringView s)
 {
-	if (s.Size() == 0)
-		return {0 , beg};
-	const auto& [x, y] = pos;
-	std::size_t i = beg;
-	int p = 0;
+	if (spec.type != 0 && spec.type != U's' && spec.type != U'c')
+		throw Util::Exception("Format: invalid type for a string");
 
-	do
+	const int max = spec.precision < 0 ? std::numeric_limits<int>::max() : spec.precision;
+	int width = 0;
+	std::size_t end = 0;
+	// Only measured when needed
+	if (spec.width > 0 || spec.precision >= 0)
 	{
-		TBChar tbc = s[i];
-		tbc.s.bg = bg;
-		const auto cell = tbc();
-		int glyph_size = wcwidth(cell.ch);
-		if (p + glyph_size > w)
+		while (end < s.size())
 		{
-			if (trailing.ch == U'\0')
+			const std::size_t j = Grapheme::Next(s, end);
+			const int size = std::max(Grapheme::Width(s.substr(end, j - end)), 0);
+			if (width + size > max)
 				break;
-			const auto cell = trailing();
-			if (i != 0)
-				p -= wcwidth(s[i - 1].ch);
-			tb_cell(x + p, y, &cell);
-			++p;
-			break;
+			width += size;
+			end = j;
 		}
-		tb_cell(x + p, y, &cell);
-		p += glyph_size;
-	} while (++i < s.Size());
+	}
+	else
+		end = s.size();
 
-	return { p, i };
+	const int pad = std::max(spec.width - width, 0);
+	const Char align = spec.align ? spec.align : U'<';
+	const int left = align == U'>' ? pad : align == U'^' ? pad / 2 : 0;
+	out.Pad(spec.fill, left);
+	out.Put(s, end);
+	out.Pad(spec.fill, pad - left);
 }
 
-std::pair<int, std::size_t> Draw::TextLine(const String& s, const TBStyle& style, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+static void formatArg(FormatWriter& out, const FormatSpec& spec, const Draw::FormatArg& arg)
 {
-	if (s.size() == 0)
-		return {0 , beg};
-	const auto& [x, y] = pos;
-	std::size_t i = beg;
-	int p = 0;
+	using Type = Draw::FormatArg::Type;
+	const bool asChar = spec.type == U'c';
+	const bool asString = spec.type == 0 || spec.type == U's';
+	switch (arg.type)
+	{
+		case Type::Bool:
+			if (asString)
+				return formatString(out, spec, arg.b ? U"true" : U"false");
+			return formatInteger(out, spec, arg.b, false);
+		case Type::Char:
+			if (asString || asChar)
+				return formatString(out, spec, StringView(&arg.c, 1));
+			return formatInteger(out, spec, arg.c, false);
+		case Type::Int:
+			if (asChar)
+			{
+				const Char c = static_cast<Char>(arg.i);
+				return formatString(out, spec, StringView(&c, 1));
+			}
+			return formatInteger(out, spec, arg.i < 0 ? 0ull - static_cast<unsigned long long>(arg.i) : arg.i, arg.i < 0);
+		case Type::UInt:
+			if (asChar)
+			{
+				const Char c = static_cast<Char>(arg.u);
+				return formatString(out, spec, StringView(&c, 1));
+			}
+			return formatInteger(out, spec, arg.u, false);
+		case Type::Float:
+			return formatFloat(out, spec, arg.f);
+		case Type::String:
+			return formatString(out, spec, StringView(arg.s.data, arg.s.size));
+	}
+}
 
-	do
+int Draw::VFormat(Vec2i pos, int w, const TBStyle& style, StringView fmt, std::span<const FormatArg> args)
+{
+	FormatWriter out(pos, w, style);
+	FormatIndex index;
+
+	std::size_t i = 0;
+	while (i < fmt.size() && !out.Full())
 	{
-		const auto cell = TBChar(s[i], style)();
-		int glyph_size = wcwidth(cell.ch);
-		if (p + glyph_size > w)
+		if (fmt[i] == U'}')
 		{
-			if (trailing.ch == U'\0')
-				break;
-			const auto cell = trailing();
-			if (i != 0)
-				p -= wcwidth(s[i - 1]);
-			tb_cell(x + p, y, &cell);
-			++p;
-			break;
+			if (i + 1 >= fmt.size() || fmt[i + 1] != U'}')
+				throw Util::Exception("Format: unmatched '}' in format");
+			out.Put(U'}');
+			i += 2;
+			continue;
+		}
+		if (fmt[i] != U'{')
+		{
+			const std::size_t j = Grapheme::Next(fmt, i);
+			out.Put(Grapheme::Intern(fmt.substr(i, j - i)));
+			i = j;
+			continue;
+		}
+		if (i + 1 < fmt.size() && fmt[i + 1] == U'{')
+		{
+			out.Put(U'{');
+			i += 2;
+			continue;
 		}
-		tb_cell(x + p, y, &cell);
-		p += glyph_size;
-	} while (++i < s.size());
 
-	return { p, i };
+		++i;
+		const FormatArg& arg = args[index.Get(fmt, i, args.size())];
+		FormatSpec spec;
+		if (i < fmt.size() && fmt[i] == U':')
+			spec = formatSpec(fmt, ++i, args, index);
+		else if (i >= fmt.size() || fmt[i] != U'}')
+			throw Util::Exception("Format: invalid replacement field");
+		++i;
+		formatArg(out, spec, arg);
+	}
+
+	return out.Finish();
 }
 
 std::pair<Vec2i, std::size_t> Draw::TextBox(const TBString& s, Vec2i pos, Vec2i dim, const TBChar& trailing)
 {
-	//TODO
+	// Keeps the lines between calls. The text holds a copy of s, which
+	// shares its characters: they cannot change or be freed while kept,
+	// so the same storage means the same text and the lines are reused
+	thread_local TextWrap text;
+	const TBString& kept = text.GetText();
+	if (kept.Data() != s.Data() || kept.Size() != s.Size())
+		text.SetText(s);
+	return Draw::TextBox(text, pos, dim, trailing);
+}
+
+std::pair<Vec2i, std::size_t> Draw::TextBox(TextWrap& text, Vec2i pos, Vec2i dim, const TBChar& trailing)
+{
 	const auto& [x, y] = pos;
 	const auto& [w, h] = dim;
-	std::size_t i = 0;
-	int j = 0;
-	while (j < h && i < s.Size() - 1)
-	{
-		auto&& [w_, i_] = TextLine(s, { x, y + j }, w, { U'\0', trailing.s }, i);
-		i = i_;
-		++j;
-	}
+	if (w <= 0 || h <= 0)
+		return { pos, 0 };
+
+	const auto& lines = text.Lines(w);
+	const int count = std::min(h, static_cast<int>(lines.size()));
+	for (int j = 0; j < count; ++j)
+		TextLine(text.View(lines[j]), { x, y + j }, w, trailing);
 
-	return { { x, y + j }, i };
+	return { { x, y + count }, count == 0 ? 0 : lines[count - 1].end };
 }
 
 void Draw::Rectangle(const TBChar& c, Vec2i pos, Vec2i size)
 {
 	const auto& [x, y] = pos;
 	const auto& [w, h] = size;
+
+	const auto [cpos, csize] = Draw::GetClip();
+	const int beg = std::max(y, cpos[1]);
+	const int end = std::min(y + h, cpos[1] + csize[1]);
+	if (beg >= end)
+		return;
+
 	const auto cell = c();
-	const auto width = wcwidth(cell.ch);
+	for (int j = beg; j < end; ++j)
+	{
+		auto [row, off] = Draw::Row({ x, j }, w);
+		fillRow(row, off, w, cell);
+	}
+}
+
+// Copy the cells of srcRect set in mask, every cell if mask is nullptr
+static void blit(const CellSurface& surface, std::pair<Vec2i, Vec2i> srcRect, Vec2i dstPos, const std::uint64_t* mask)
+{
+	// Clip the source to the surface, then the destination to the clipping rectangle
+	const auto [spos, ssize] = intersect(srcRect, { Vec2i(0, 0), surface.GetSize() });
+	const Vec2i dstOffset = dstPos + target().offset - srcRect.first;
+	const auto [cpos, csize] = targetClip();
+	const auto [dpos, dsize] = intersect({ spos + dstOffset, ssize }, { cpos, csize });
+	if (dsize[0] == 0 || dsize[1] == 0)
+		return;
+
+	const auto [cells, dim] = targetBuffer();
+	const WideMap dwide = targetWide();
+	const Vec2i src = dpos - dstOffset;
+	const int sw = surface.GetSize()[0];
+	const std::size_t sstride = Cells::BitmapWords(sw + 1);
+	const std::size_t mstride = Cells::BitmapWords(sw);
+	for (int j = 0; j < dsize[1]; ++j)
+	{
+		const std::uint64_t* srowMask = mask ? mask + (src[1] + j) * mstride : nullptr;
+		const auto copied = [&](int i) { return !srowMask || Cells::Test(srowMask, src[0] + i); };
+
+		// Copied in runs of consecutive cells
+		for (int i = 0; i < dsize[0];)
+		{
+			if (!copied(i))
+			{
+				++i;
+				continue;
+			}
+			int w = srowMask ? 1 : dsize[0];
+			while (i + w < dsize[0] && copied(i + w))
+				++w;
+
+			const int sx = src[0] + i;
+			const int dx = dpos[0] + i;
+			const struct tb_cell* srow = surface.Data() + sx + (src[1] + j) * sw;
+			const std::uint64_t* swide = surface.WideData() + (src[1] + j) * sstride;
+			struct tb_cell* drow = cells + dx + (dpos[1] + j) * dim[0];
+			std::uint64_t* dbits = dwide.bits + (dpos[1] + j) * dwide.stride;
+			std::memcpy(drow, srow, w * sizeof(struct tb_cell));
 
-	for (int i = 0; i < w; ++i)
-		for (int j = 0; j < h; ++j)
-			tb_char(x + i, y + j, cell.fg, cell.bg, (i % width || i + width > w) ? U' ' : cell.ch);
+			// Wide characters of the surface cut on either side
+			if (Cells::Test(swide, sx))
+				drow[0].ch = U' ';
+			if (Cells::Test(swide, sx + w))
+				drow[w - 1].ch = U' ';
+			// Wide character of the target overlapping with the copy
+			const bool overlap = dx > cpos[0] && testBit(dbits, dx);
+			if (overlap)
+				drow[-1].ch = U' ';
+
+			writeBits(dbits, dx + (overlap ? 0 : 1), dx + w + 1, [&](int x)
+			{
+				return x > dx && x < dx + w && Cells::Test(swide, x - dx + sx);
+			});
+			damage(Vec2i(dx - overlap, dpos[1] + j), Vec2i(w + overlap, 1));
+			i += w;
+		}
+	}
+}
+
+void Draw::Blit(const CellSurface& surface, std::pair<Vec2i, Vec2i> srcRect, Vec2i dstPos)
+{
+	blit(surface, srcRect, dstPos, nullptr);
+}
+
+void Draw::Blit(const CellSurface& surface, Vec2i dstPos)
+{
+	blit(surface, { Vec2i(0, 0), surface.GetSize() }, dstPos, nullptr);
+}
+
+void Draw::Blit(const CellSurface& surface, Vec2i dstPos, const std::uint64_t* mask)
+{
+	blit(surface, { Vec2i(0, 0), surface.GetSize() }, dstPos, mask);
+}
+
+// Copy the cells set in mask to the surface, every cell if mask is nullptr
+static void capture(CellSurface& surface, Vec2i pos, const std::uint64_t* mask)
+{
+	const auto& [w, h] = surface.GetSize();
+	const auto [cells, dim] = targetBuffer();
+	const WideMap wide = targetWide();
+	const std::size_t stride = Cells::BitmapWords(w + 1);
+	const std::size_t mstride = Cells::BitmapWords(w);
+	for (int j = 0; j < h; ++j)
+	{
+		const auto [row, off] = targetRow(pos + Vec2i(0, j), w);
+		if (row.empty())
+			continue;
+
+		const std::size_t i = row.data() - cells;
+		std::uint64_t* bits = wide.bits + (i / dim[0]) * wide.stride;
+		const int x = i % dim[0];
+		const std::uint64_t* rowMask = mask ? mask + j * mstride : nullptr;
+		const auto copied = [&](int k) { return !rowMask || Cells::Test(rowMask, off + k); };
+		const int n = static_cast<int>(row.size());
+		for (int k = 0; k < n;)
+		{
+			if (!copied(k))
+			{
+				++k;
+				continue;
+			}
+			int run = rowMask ? 1 : n;
+			while (k + run < n && copied(k + run))
+				++run;
+
+			std::memcpy(surface.Data() + off + k + j * w, row.data() + k, run * sizeof(struct tb_cell));
+			writeBits(surface.WideData() + j * stride, off + k + 1, off + k + run + 1,
+				[&](int b) { return testBit(bits, x + b - off); });
+			k += run;
+		}
+	}
+}
+
+void Draw::Capture(CellSurface& surface, Vec2i pos)
+{
+	capture(surface, pos, nullptr);
+}
+
+void Draw::Capture(CellSurface& surface, Vec2i pos, const std::uint64_t* mask)
+{
+	capture(surface, pos, mask);
+}
+
+void Draw::Blend(const Color& color, std::uint8_t alpha, Vec2i pos, Vec2i size)
+{
+	const auto& [x, y] = pos;
+	const auto& [w, h] = size;
+
+	const auto [cpos, csize] = Draw::GetClip();
+	const int beg = std::max(y, cpos[1]);
+	const int end = std::min(y + h, cpos[1] + csize[1]);
+	for (int j = beg; j < end; ++j)
+	{
+		const auto [row, off] = Draw::Row({ x, j }, w);
+		Cells::Blend(row.data(), row.size(), color(), alpha,
+			Settings::Colors::blend_foreground(), Settings::Colors::blend_background());
+	}
+}
+
+void Draw::Shadow(Vec2i pos, Vec2i size, std::uint8_t alpha)
+{
+	Draw::Blend(0x000000, alpha, pos + Vec2i(size[0], 1), Vec2i(1, size[1]));
+	Draw::Blend(0x000000, alpha, pos + Vec2i(1, size[1]), Vec2i(size[0] - 1, 1));
 }
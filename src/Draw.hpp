@@ -2,6 +2,10 @@
 #define TERMBOXWIDGETS_DRAW_HPP
 
 #include "Settings.hpp"
+#include "Wrap.hpp"
+#include <span>
+#include <tuple>
+class CellSurface;
 ////////////////////////////////////////////////
 /// \brief Low level drawing primitives
 /// \ingroup Records
@@ -24,6 +28,129 @@ MAKE_CENUM_Q(BorderFlag, std::uint8_t,
 	All         , Corners | Borders);
 /** @endcond */
 
+////////////////////////////////////////////////
+/// \brief Draw to a surface instead of the screen
+///
+/// Every drawing primitive will write to surface until
+/// PopTarget() is called
+/// \param surface The surface to draw to
+/// \param origin The position of the surface's first cell, i.e
+///  drawing at origin will write to the surface's first cell
+/// \note Each target has its own translation and clipping rectangle
+///  stacks, which start empty (i.e the whole surface)
+/// \see CellSurface
+////////////////////////////////////////////////
+void PushTarget(CellSurface& surface, Vec2i origin = Vec2i(0, 0));
+////////////////////////////////////////////////
+/// \brief Restore the previous drawing target
+/// \note The screen is never popped
+////////////////////////////////////////////////
+void PopTarget();
+////////////////////////////////////////////////
+/// \brief Push a translation
+///
+/// Every position given to the drawing primitives will be offset
+/// until it is popped, so that widgets can draw in their parent's
+/// coordinates
+/// \param offset The translation, added to the current one
+////////////////////////////////////////////////
+void PushTranslation(Vec2i offset);
+////////////////////////////////////////////////
+/// \brief Pop the last translation
+////////////////////////////////////////////////
+void PopTranslation();
+////////////////////////////////////////////////
+/// \brief Get the screen position of a position
+///
+/// \param pos The position, in the current coordinates
+/// \returns The position on the screen, e.g for Termbox::SetCursor
+////////////////////////////////////////////////
+Vec2i ToScreen(Vec2i pos);
+////////////////////////////////////////////////
+/// \brief Push a clipping rectangle
+///
+/// Every drawing primitive will only write inside of the
+/// clipping rectangle until it is popped
+/// \param pos The position of the rectangle, translated
+/// \param size The size of the rectangle
+/// \note The rectangle is intersected with the current clipping rectangle
+////////////////////////////////////////////////
+void PushClip(Vec2i pos, Vec2i size);
+////////////////////////////////////////////////
+/// \brief Pop the last clipping rectangle
+////////////////////////////////////////////////
+void PopClip();
+////////////////////////////////////////////////
+/// \brief Get the current clipping rectangle
+///
+/// \returns The current clipping rectangle, intersected with the target
+///  and in the current coordinates
+////////////////////////////////////////////////
+std::pair<Vec2i, Vec2i> GetClip();
+////////////////////////////////////////////////
+/// \brief Get a row of the cell buffer
+///
+/// \param pos The begining position of the row
+/// \param w The width of the row
+/// \returns The cells of the row that are inside the clipping rectangle and
+///  the number of cells that were clipped on the left side of the row
+///
+/// \note The returned span is invalidated by Termbox::Resize or CellSurface::Resize
+////////////////////////////////////////////////
+std::pair<std::span<struct tb_cell>, int> Row(Vec2i pos, int w);
+////////////////////////////////////////////////
+/// \brief Get a column of the cell buffer
+///
+/// \param pos The begining position of the column
+/// \param h The height of the column
+/// \returns The first cell of the column inside the clipping rectangle,
+///  the distance between two cells of the column, the number of cells and
+///  the number of cells that were clipped on the top of the column
+////////////////////////////////////////////////
+std::tuple<struct tb_cell*, int, int, int> Column(Vec2i pos, int h);
+////////////////////////////////////////////////
+/// \brief Record the wide characters of cells written to the current target
+///
+/// The primitives do it on their own, this is only needed when cells
+/// returned by Row or Column are written directly.
+/// \param row The written cells, as returned by Row. The first cell is
+///  considered to start a character.
+////////////////////////////////////////////////
+void MarkWide(std::span<const struct tb_cell> row);
+////////////////////////////////////////////////
+/// \brief Check if a cell is covered by the second half of a wide character
+///
+/// \param pos The position of the cell, may be one past the last column
+/// \returns True if the cell on the left of pos holds a wide character
+/// \note Does not depend on the clipping rectangle
+////////////////////////////////////////////////
+bool IsContinuation(Vec2i pos);
+////////////////////////////////////////////////
+/// \brief Forget the wide characters of the screen
+///
+/// Called by Termbox when the screen is cleared or resized
+////////////////////////////////////////////////
+void ClearWide();
+////////////////////////////////////////////////
+/// \brief Record the cells written to a rectangle of the current target
+///
+/// Until Unwatch is called, the cells of the rectangle that are returned
+/// by Row or Column, or copied by Blit, are set in a bitmap. Only the
+/// cells inside of the current clipping rectangle are recorded, and only
+/// while the target is current.
+/// \param damage The bitmap, `Cells::BitmapWords(size[0])` words per row.
+///  Its bits are set, never cleared.
+/// \param pos The position of the rectangle
+/// \param size The size of the rectangle
+/// \note Drawing is slower while cells are watched
+////////////////////////////////////////////////
+void Watch(std::uint64_t* damage, Vec2i pos, Vec2i size);
+////////////////////////////////////////////////
+/// \brief Stop recording the cells written to a rectangle
+///
+/// \param damage The bitmap given to Watch
+////////////////////////////////////////////////
+void Unwatch(const std::uint64_t* damage);
 ////////////////////////////////////////////////
 /// \brief Draw a border
 ///
@@ -68,6 +195,146 @@ void Vertical(const TBChar& c, Vec2i pos, int h);
 ////////////////////////////////////////////////
 void Vertical(std::function<struct tb_cell(const struct tb_cell&, Vec2i pos)> charFn, Vec2i pos, int h);
 ////////////////////////////////////////////////
+/// \brief Draw a vertical line
+///
+/// \param charFn A callable that will return the character to be displayed
+/// \param pos The begining position of the line
+/// \param h The height of the line
+/// \tparam F The type of charFn, invoked as ```struct tb_cell(const struct tb_cell&, Vec2i)```
+/// \note Unlike the std::function overload, charFn can be inlined
+////////////////////////////////////////////////
+template <class F> requires std::is_invocable_r_v<struct tb_cell, F, const struct tb_cell&, Vec2i>
+void Vertical(F&& charFn, Vec2i pos, int h);
+
+////////////////////////////////////////////////
+/// \brief Source adapter for a TBString or a TBStringView
+////////////////////////////////////////////////
+struct TBStringSource
+{
+	TBStringView s;
+
+	std::size_t Size() const { return s.Size(); }
+	::Char Ch(std::size_t i) const { return s.Ch(i); }
+	const TBStyle& Style(std::size_t i) const { return s.Style(i); }
+};
+
+////////////////////////////////////////////////
+/// \brief Source adapter for a String with a single style
+////////////////////////////////////////////////
+struct StringSource
+{
+	StringView s;
+	const TBStyle& style;
+
+	std::size_t Size() const { return s.size(); }
+	::Char Ch(std::size_t i) const { return s[i]; }
+	const TBStyle& Style(std::size_t) const { return style; }
+};
+
+////////////////////////////////////////////////
+/// \brief Style transform that keeps the style as is
+////////////////////////////////////////////////
+struct StyleIdentity
+{
+	constexpr void operator()(TBStyle&, std::size_t) const {}
+};
+
+////////////////////////////////////////////////
+/// \brief Style transform that adds a TextStyle
+////////////////////////////////////////////////
+struct StyleAdd
+{
+	TextStyle textstyle;
+
+	constexpr void operator()(TBStyle& s, std::size_t) const
+	{
+		s.s = static_cast<std::uint32_t>(s.s) | textstyle;
+	}
+};
+
+////////////////////////////////////////////////
+/// \brief Style transform that replaces the foreground
+////////////////////////////////////////////////
+struct StyleForeground
+{
+	Color fg;
+
+	constexpr void operator()(TBStyle& s, std::size_t) const
+	{
+		s.fg = fg;
+	}
+};
+
+////////////////////////////////////////////////
+/// \brief Style transform that replaces the background
+////////////////////////////////////////////////
+struct StyleBackground
+{
+	Color bg;
+
+	constexpr void operator()(TBStyle& s, std::size_t) const
+	{
+		s.bg = bg;
+	}
+};
+
+////////////////////////////////////////////////
+/// \brief Style transform that replaces the style of the characters in [beg, end)
+////////////////////////////////////////////////
+struct StyleHighlight
+{
+	std::size_t beg, end;
+	TBStyle style;
+
+	constexpr void operator()(TBStyle& s, std::size_t i) const
+	{
+		if (i >= beg && i < end)
+			s = style;
+	}
+};
+
+////////////////////////////////////////////////
+/// \brief Style transform that applies several transforms in order
+/// \code{.cpp}
+/// // Bold text on a red background, with [4, 8) highlighted
+/// Draw::StyleCompose transform{ Draw::StyleAdd{ TextStyle::Bold }, Draw::StyleBackground{ 0xFF0000 }, Draw::StyleHighlight{ 4, 8, style } };
+/// \endcode
+////////////////////////////////////////////////
+template <class... Ts>
+struct StyleCompose
+{
+	std::tuple<Ts...> transforms;
+
+	constexpr StyleCompose(Ts... ts):
+		transforms(ts...)
+	{
+	}
+
+	constexpr void operator()(TBStyle& s, std::size_t i) const
+	{
+		std::apply([&](const auto&... t) { (t(s, i), ...); }, transforms);
+	}
+};
+
+////////////////////////////////////////////////
+/// \brief Draw text on a single line
+///
+/// \param src The source of the characters and their style
+/// \param transform The transform applied to the style of each character
+/// \param pos The begining position of the text
+/// \param w The maximum width of the line
+/// \param trailing The character to indicate that the line was too long
+/// \param beg The begining position in the source
+/// \tparam Source A source adapter, e.g TBStringSource
+/// \tparam Transform A style transform, e.g StyleAdd
+/// \returns The width of the drawn line and the index of the last character drawn
+///
+/// \note Passing ```U'\0'``` as a trailing char, will cause it to ignore it and write text until no space is left
+/// \note The returned values do not depend on the clipping rectangle
+////////////////////////////////////////////////
+template <class Source, class Transform>
+std::pair<int, std::size_t> TextLineKernel(const Source& src, const Transform& transform, Vec2i pos, int w, const TBChar& trailing, std::size_t beg = 0ul);
+////////////////////////////////////////////////
 /// \brief Draw text on a single line
 ///
 /// \param s The TBString to draw
@@ -83,6 +350,33 @@ std::pair<int, std::size_t> TextLine(const TBString& s, Vec2i pos, int w, const
 ////////////////////////////////////////////////
 /// \brief Draw text on a single line
 ///
+/// \param s The characters to draw, they are not copied
+/// \param pos The begining position of the text
+/// \param w The maximum width of the line
+/// \param trailing The character to indicate that the line was too long
+/// \param beg The begining position in the view
+/// \returns The width of the drawn line and the index of the last character drawn
+///
+/// \note Passing ```U'\0'``` as a trailing char, will cause it to ignore it and write text until no space is left
+/// \see TBStringView
+////////////////////////////////////////////////
+std::pair<int, std::size_t> TextLine(TBStringView s, Vec2i pos, int w, const TBChar& trailing, std::size_t beg = 0ul);
+////////////////////////////////////////////////
+/// \brief Draw text on a single line
+///
+/// \param s The characters to draw
+/// \param pos The begining position of the text
+/// \param w The maximum width of the line
+/// \param trailing The character to indicate that the line was too long
+/// \param beg The begining position in the span
+/// \returns The width of the drawn line and the index of the last character drawn
+///
+/// \note Passing ```U'\0'``` as a trailing char, will cause it to ignore it and write text until no space is left
+////////////////////////////////////////////////
+std::pair<int, std::size_t> TextLine(std::span<const TBChar> s, Vec2i pos, int w, const TBChar& trailing, std::size_t beg = 0ul);
+////////////////////////////////////////////////
+/// \brief Draw text on a single line
+///
 /// \param s The TBString to draw
 /// \param textstyle Additional text style
 /// \param pos The begining position of the text
@@ -111,7 +405,7 @@ std::pair<int, std::size_t> TextLineBackground(const TBString& s, Color bg, Vec2
 ////////////////////////////////////////////////
 /// \brief Draw text on a single line
 ///
-/// \param s The String to draw
+/// \param s The characters to draw, drawn one codepoint per cell
 /// \param style The style of the string
 /// \param pos The begining position of the text
 /// \param w The maximum width of the line
@@ -121,18 +415,106 @@ std::pair<int, std::size_t> TextLineBackground(const TBString& s, Color bg, Vec2
 ///
 /// \note Passing ```U'\0'``` as a trailing char, will cause it to ignore it and write text until no space is left
 ////////////////////////////////////////////////
-std::pair<int, std::size_t> TextLine(const String& s, const TBStyle& style, Vec2i pos, int w, const TBChar& trailing, std::size_t beg = 0ul);
+std::pair<int, std::size_t> TextLine(StringView s, const TBStyle& style, Vec2i pos, int w, const TBChar& trailing, std::size_t beg = 0ul);
+////////////////////////////////////////////////
+/// \brief Argument of Format, without its type
+////////////////////////////////////////////////
+struct FormatArg
+{
+	enum class Type : std::uint8_t
+	{
+		Bool,
+		Char,
+		Int,
+		UInt,
+		Float,
+		String,
+	};
+
+	Type type;
+	union
+	{
+		bool b;
+		::Char c;
+		long long i;
+		unsigned long long u;
+		double f;
+		struct
+		{
+			const ::Char* data;
+			std::size_t size;
+		} s;
+	};
+
+	////////////////////////////////////////////////
+	/// \brief Constructor
+	///
+	/// \param v The value, a boolean, a Char, an arithmetic type or
+	///  anything convertible to StringView. Strings are not copied.
+	////////////////////////////////////////////////
+	template <class T>
+	constexpr FormatArg(const T& v);
+};
+////////////////////////////////////////////////
+/// \brief Format text on a single line
+///
+/// \param pos The begining position of the text
+/// \param w The maximum width of the line, the text is cut past it
+/// \param style The style of the text
+/// \param fmt The format, see Format
+/// \param args The arguments
+/// \returns The width of the drawn text
+////////////////////////////////////////////////
+int VFormat(Vec2i pos, int w, const TBStyle& style, StringView fmt, std::span<const FormatArg> args);
+////////////////////////////////////////////////
+/// \brief Format text on a single line
+///
+/// Follows the syntax of std::format, replacement fields are
+/// `{[arg-id][:[[fill]align][sign][#][0][width][.precision][type]]}`,
+/// where width and precision may be given by an argument (`{:{}}`).
+///  - Integers: `d`, `b`, `B`, `o`, `x`, `X`, `c`
+///  - Floats: `f`, `F`, `e`, `E`, `g`, `G`, `a`, `A`, the shortest
+///   representation when there is no type nor precision
+///  - Strings: `s`, the precision is the maximum width of the string
+///
+/// Widths are counted in cells. The characters are written directly
+/// in the cell buffer, numbers are converted on the stack.
+/// \code{.cpp}
+/// Draw::Format(pos, w, style, U"{:>4} {} ({:.1f}%)", index, name, ratio * 100.0);
+/// \endcode
+/// \param pos The begining position of the text
+/// \param w The maximum width of the line, the text is cut past it
+/// \param style The style of the text
+/// \param fmt The format
+/// \param args The arguments
+/// \returns The width of the drawn text
+/// \throws Util::Exception if the format is invalid
+////////////////////////////////////////////////
+template <class... Args>
+int Format(Vec2i pos, int w, const TBStyle& style, StringView fmt, const Args&... args);
 ////////////////////////////////////////////////
 /// \brief Draw text in a box
 ///
+/// The text is wrapped between words, lines that do not fit in the box are not drawn
 /// \param s The TBString to draw
 /// \param pos The begining position of the text
 /// \param dim The dimension of the pox
 /// \param trailing The character to indicate that the line was too long
-/// \returns The position of the end of the text and the index of the last drawn character
+/// \returns The position of the end of the text and the index past the last drawn character
+/// \note The text is wrapped again only when s or the width changes, the last string drawn by a thread is kept alive until the next call
 ////////////////////////////////////////////////
 std::pair<Vec2i, std::size_t> TextBox(const TBString& s, Vec2i pos, Vec2i dim, const TBChar& trailing);
 ////////////////////////////////////////////////
+/// \brief Draw wrapped text in a box
+///
+/// \param text The text, wrapped to the width of the box if it changed
+/// \param pos The begining position of the text
+/// \param dim The dimension of the pox
+/// \param trailing The character to indicate that the line was too long
+/// \returns The position of the end of the text and the index past the last drawn character
+////////////////////////////////////////////////
+std::pair<Vec2i, std::size_t> TextBox(TextWrap& text, Vec2i pos, Vec2i dim, const TBChar& trailing);
+////////////////////////////////////////////////
 /// \brief Draw a rectangle
 ///
 /// \param c The TBChar to fill the rectangle with
@@ -140,6 +522,87 @@ std::pair<Vec2i, std::size_t> TextBox(const TBString& s, Vec2i pos, Vec2i dim, c
 /// \param size The sizes of the rectangle
 ////////////////////////////////////////////////
 void Rectangle(const TBChar& c, Vec2i pos, Vec2i size);
+////////////////////////////////////////////////
+/// \brief Copy a part of a surface
+///
+/// \param surface The surface to copy from
+/// \param srcRect The rectangle of the surface to copy
+/// \param dstPos The position to copy to
+///
+/// \note Wide characters cut by the copy are replaced by spaces
+////////////////////////////////////////////////
+void Blit(const CellSurface& surface, std::pair<Vec2i, Vec2i> srcRect, Vec2i dstPos);
+////////////////////////////////////////////////
+/// \brief Copy a surface
+///
+/// \param surface The surface to copy
+/// \param dstPos The position to copy to
+////////////////////////////////////////////////
+void Blit(const CellSurface& surface, Vec2i dstPos);
+////////////////////////////////////////////////
+/// \brief Copy the cells of a surface set in a bitmap
+///
+/// \param surface The surface to copy
+/// \param dstPos The position to copy to
+/// \param mask The bitmap of the cells to copy, `Cells::BitmapWords(w)`
+///  words per row of the surface (see Watch)
+////////////////////////////////////////////////
+void Blit(const CellSurface& surface, Vec2i dstPos, const std::uint64_t* mask);
+////////////////////////////////////////////////
+/// \brief Copy cells of the current target to a surface
+///
+/// \param surface The surface to copy to, it is filled entirely
+/// \param pos The position of the first cell to copy
+///
+/// \note Cells outside of the clipping rectangle are left unchanged
+////////////////////////////////////////////////
+void Capture(CellSurface& surface, Vec2i pos);
+////////////////////////////////////////////////
+/// \brief Copy the cells of the current target set in a bitmap to a surface
+///
+/// \param surface The surface to copy to
+/// \param pos The position of the first cell of the surface
+/// \param mask The bitmap of the cells to copy, `Cells::BitmapWords(w)`
+///  words per row of the surface (see Watch)
+////////////////////////////////////////////////
+void Capture(CellSurface& surface, Vec2i pos, const std::uint64_t* mask);
+////////////////////////////////////////////////
+/// \brief Blend the colors of a rectangle toward a color
+///
+/// Used to dim what is behind a modal window, without drawing it again:
+/// \code{.cpp}
+/// Draw::Blend(0x000000, 128, { 0, 0 }, Termbox::GetDim());
+/// \endcode
+/// \param color The color to blend toward
+/// \param alpha The weight of color, from 0 (unchanged) to 255 (replaced)
+/// \param pos The begining position of the rectangle
+/// \param size The sizes of the rectangle
+///
+/// \note Blending applies to the cells as they are, it must be done once
+///  every time the cells below are drawn
+/// \see Settings::Colors::blend_foreground
+////////////////////////////////////////////////
+void Blend(const Color& color, std::uint8_t alpha, Vec2i pos, Vec2i size);
+////////////////////////////////////////////////
+/// \brief Draw the shadow of a rectangle
+///
+/// Darkens the column on the right and the row below the rectangle,
+/// shifted by one cell
+///
+/// As for Rectangle, size is exclusive: the shadow is drawn at column
+/// pos.x + size.x and row pos.y + size.y. Bordered widgets draw their
+/// borders there, their shadow is one cell further:
+/// \code{.cpp}
+/// Draw::Shadow(GetPosition(), GetSize() + Vec2i(1, 1));
+/// \endcode
+/// \param pos The begining position of the rectangle
+/// \param size The sizes of the rectangle, exclusive
+/// \param alpha The opacity of the shadow
+////////////////////////////////////////////////
+void Shadow(Vec2i pos, Vec2i size, std::uint8_t alpha = Settings::shadow_alpha);
 }
+/** @cond */
+#include "Draw.tcc"
+/** @endcond */
 
 #endif // TERMBOXWIDGETS_DRAW_HPP
@@ -0,0 +1,126 @@
+#include "Draw.hpp"
+
+template <class F> requires std::is_invocable_r_v<struct tb_cell, F, const struct tb_cell&, Vec2i>
+void Draw::Vertical(F&& charFn, Vec2i pos, int h)
+{
+	const auto [cells, stride, count, skipped] = Draw::Column(pos, h);
+
+	for (int j = 0; j < count; ++j)
+	{
+		struct tb_cell& cell = cells[j * stride];
+		cell = charFn(cell, pos + Vec2i(0, skipped + j));
+		Draw::MarkWide({ &cell, 1 });
+	}
+}
+
+template <class Source, class Transform>
+std::pair<int, std::size_t> Draw::TextLineKernel(const Source& src, const Transform& transform, Vec2i pos, int w, const TBChar& trailing, std::size_t beg)
+{
+	const std::size_t size = src.Size();
+	if (beg >= size)
+		return { 0, beg };
+
+	auto [row, off] = Draw::Row(pos, w);
+	// Visible part of the line: [off, end)
+	const int end = off + static_cast<int>(row.size());
+
+	std::size_t i = beg;
+	int p = 0;
+	int glyph_size = 0;
+	// Glyphs are measured without being drawn until the visible part is reached,
+	// then drawn until it is left, then measured until the line is full
+	// (control characters are measured as zero-width)
+	while (i < size && p < off)
+	{
+		glyph_size = std::max(Grapheme::Width(src.Ch(i)), 0);
+		if (p + glyph_size > w)
+			break;
+		p += glyph_size;
+		++i;
+	}
+	// Drawn cells: [first, last)
+	int first = p;
+	int last = p;
+	while (i < size)
+	{
+		glyph_size = std::max(Grapheme::Width(src.Ch(i)), 0);
+		if (p + glyph_size > w || p + std::max(glyph_size, 1) > end)
+			break;
+
+		TBChar c(src.Ch(i), src.Style(i));
+		transform(c.s, i);
+		row[p - off] = c();
+		last = p + std::max(glyph_size, 1);
+		p += glyph_size;
+		++i;
+	}
+	while (i < size)
+	{
+		glyph_size = std::max(Grapheme::Width(src.Ch(i)), 0);
+		if (p + glyph_size > w)
+			break;
+		p += glyph_size;
+		++i;
+	}
+
+	if (i < size && trailing.ch != U'\0')
+	{
+		if (i != 0)
+			p -= std::max(Grapheme::Width(src.Ch(i - 1)), 0);
+		if (p >= off && p < end)
+		{
+			row[p - off] = trailing();
+			first = std::min(first, p);
+			last = std::max(last, p + 1);
+		}
+		++p;
+	}
+	if (first < last)
+		Draw::MarkWide(row.subspan(first - off, last - first));
+
+	return { p, i };
+}
+
+template <class T>
+constexpr Draw::FormatArg::FormatArg(const T& v)
+{
+	if constexpr (std::is_same_v<T, bool>)
+	{
+		type = Type::Bool;
+		b = v;
+	}
+	else if constexpr (std::is_same_v<T, ::Char>)
+	{
+		type = Type::Char;
+		c = v;
+	}
+	else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+	{
+		type = Type::Int;
+		i = v;
+	}
+	else if constexpr (std::is_integral_v<T>)
+	{
+		type = Type::UInt;
+		u = v;
+	}
+	else if constexpr (std::is_floating_point_v<T>)
+	{
+		type = Type::Float;
+		f = v;
+	}
+	else
+	{
+		static_assert(std::is_convertible_v<const T&, StringView>, "Unsupported argument type for Draw::Format");
+		const StringView sv(v);
+		type = Type::String;
+		s = { sv.data(), sv.size() };
+	}
+}
+
+template <class... Args>
+int Draw::Format(Vec2i pos, int w, const TBStyle& style, StringView fmt, const Args&... args)
+{
+	const std::array<FormatArg, sizeof...(Args)> a{ FormatArg(args)... };
+	return Draw::VFormat(pos, w, style, fmt, a);
+}
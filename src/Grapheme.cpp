@@ -0,0 +1,261 @@
+#include "Grapheme.hpp"
+#include <deque>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+
+static constexpr Char s_zwj = 0x200D;
+
+struct Entry
+{
+	String cluster; // Empty once freed
+	std::atomic<std::uint32_t> refs = 0; // TBChar holding the cluster
+	std::atomic<std::uint32_t> generation = 0; // Last generation the cluster was interned, released or marked in
+};
+struct Pool
+{
+	std::deque<Entry> entries; // Kept in place, the index holds views into their codepoints
+	std::unordered_map<StringView, Char> index;
+	std::vector<Char> free; // Indices of freed entries
+	std::uint32_t generation = 0;
+	std::shared_mutex mutex;
+};
+
+// Never destroyed: TBChar with static storage may release clusters at exit
+static Pool& pool()
+{
+	static Pool* pool = new Pool();
+	return *pool;
+}
+
+// Returned for clusters that were freed while cells still held them
+static constexpr Char s_replacement = 0xFFFD;
+
+static constexpr bool isControl(Char c)
+{
+	return c < 0x20 || (c >= 0x7F && c < 0xA0);
+}
+
+static constexpr bool isRegional(Char c)
+{
+	return c >= 0x1F1E6 && c <= 0x1F1FF;
+}
+
+// Codepoints that attach to the previous one
+static bool isExtend(Char c)
+{
+	if (c < 0x300)
+		return false;
+	if (c == s_zwj || c == 0x200C ||
+		(c >= 0xFE00 && c <= 0xFE0F) || // Variation selectors
+		(c >= 0x1F3FB && c <= 0x1F3FF) || // Emoji modifiers
+		(c >= 0xE0020 && c <= 0xE007F) || // Tags
+		(c >= 0xE0100 && c <= 0xE01EF))
+		return true;
+
+	// Zero width format characters break clusters
+	if (c == 0x200B || c == 0x200E || c == 0x200F || c == 0xFEFF ||
+		(c >= 0x2028 && c <= 0x202E) || (c >= 0x2060 && c <= 0x206F))
+		return false;
+	return wcwidth(c) == 0;
+}
+
+// Width of a cluster of more than one codepoint
+static int clusterWidth(StringView cluster)
+{
+	const int base = std::max(wcwidth(cluster[0]), 0);
+	if (isRegional(cluster[0]))
+		return 2;
+	for (const Char c : cluster)
+	{
+		if (c == 0xFE0F) // Emoji presentation
+			return 2;
+		if (c == 0xFE0E) // Text presentation
+			return std::min(base, 1);
+	}
+	return base;
+}
+
+int Grapheme::Width(StringView cluster)
+{
+	if (cluster.size() == 1)
+		return wcwidth(cluster[0]);
+	if (cluster.empty())
+		return 0;
+	return clusterWidth(cluster);
+}
+
+std::size_t Grapheme::Next(StringView s, std::size_t i)
+{
+	const std::size_t size = s.size();
+	if (i >= size)
+		return size;
+
+	std::size_t j = i + 1;
+	// Most text is made of single codepoints, that nothing attaches to
+	if (j == size || (s[j] < 0x300 && s[i] != U'\r'))
+		return j;
+	if (s[i] == U'\r')
+		return s[j] == U'\n' ? j + 1 : j;
+	if (isControl(s[i]))
+		return j;
+
+	if (isRegional(s[i]) && isRegional(s[j]))
+		++j;
+	while (j < size)
+	{
+		if (isExtend(s[j]) || (s[j - 1] == s_zwj && !isControl(s[j])))
+			++j;
+		else
+			break;
+	}
+	return j;
+}
+
+Char Grapheme::Intern(StringView cluster)
+{
+	if (cluster.size() == 1)
+		return cluster[0];
+	if (cluster.empty())
+		return 0;
+
+	Pool& p = pool();
+	{
+		std::shared_lock lock(p.mutex);
+		if (const auto it = p.index.find(cluster); it != p.index.end())
+		{
+			// Not freed before the TBChar that will hold it is made
+			p.entries[it->second & index_mask].generation.store(p.generation, std::memory_order_relaxed);
+			return it->second;
+		}
+	}
+
+	std::unique_lock lock(p.mutex);
+	if (const auto it = p.index.find(cluster); it != p.index.end())
+	{
+		p.entries[it->second & index_mask].generation.store(p.generation, std::memory_order_relaxed);
+		return it->second;
+	}
+
+	Char index;
+	if (!p.free.empty())
+	{
+		index = p.free.back();
+		p.free.pop_back();
+	}
+	else if (p.entries.size() <= index_mask)
+	{
+		index = static_cast<Char>(p.entries.size());
+		p.entries.emplace_back();
+	}
+	else
+		throw Util::Exception("Grapheme: the pool of clusters is full");
+
+	Entry& entry = p.entries[index];
+	entry.cluster = cluster;
+	entry.refs.store(0, std::memory_order_relaxed);
+	entry.generation.store(p.generation, std::memory_order_relaxed);
+	const Char c = cluster_tag | (static_cast<Char>(clusterWidth(cluster)) << width_shift) | index;
+	p.index.emplace(entry.cluster, c);
+	return c;
+}
+
+StringView Grapheme::Get(const Char& c)
+{
+	if (!IsCluster(c))
+		return StringView(&c, 1);
+
+	Pool& p = pool();
+	std::shared_lock lock(p.mutex);
+	const String& cluster = p.entries[c & index_mask].cluster;
+	if (cluster.empty())
+		return StringView(&s_replacement, 1);
+	return cluster;
+}
+
+Char Grapheme::Base(Char c)
+{
+	if (!IsCluster(c))
+		return c;
+
+	Pool& p = pool();
+	std::shared_lock lock(p.mutex);
+	const String& cluster = p.entries[c & index_mask].cluster;
+	return cluster.empty() ? s_replacement : cluster[0];
+}
+
+void Grapheme::Acquire(Char c)
+{
+	Pool& p = pool();
+	std::shared_lock lock(p.mutex);
+	p.entries[c & index_mask].refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Grapheme::Release(Char c)
+{
+	Pool& p = pool();
+	std::shared_lock lock(p.mutex);
+	Entry& entry = p.entries[c & index_mask];
+	// Cells copied from the last TBChar may still be drawn, they get the same delay as marked cells
+	if (entry.refs.fetch_sub(1, std::memory_order_relaxed) == 1)
+		entry.generation.store(p.generation, std::memory_order_relaxed);
+}
+
+void Grapheme::Mark(const struct tb_cell* cells, std::size_t size)
+{
+	if (!HasClusters(cells, size))
+		return;
+
+	Pool& p = pool();
+	std::shared_lock lock(p.mutex);
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		if (IsCluster(cells[i].ch))
+			p.entries[cells[i].ch & index_mask].generation.store(p.generation, std::memory_order_relaxed);
+	}
+}
+
+std::size_t Grapheme::Collect()
+{
+	Pool& p = pool();
+	std::unique_lock lock(p.mutex);
+	const std::uint32_t generation = p.generation++;
+	std::size_t freed = 0;
+	for (std::size_t i = 0; i < p.entries.size(); ++i)
+	{
+		Entry& entry = p.entries[i];
+		// Kept through two generations: the terminal still shows the previous frame
+		if (entry.cluster.empty() || entry.refs.load(std::memory_order_relaxed) != 0 ||
+			generation - entry.generation.load(std::memory_order_relaxed) < 2)
+			continue;
+
+		p.index.erase(entry.cluster);
+		String().swap(entry.cluster);
+		p.free.push_back(static_cast<Char>(i));
+		++freed;
+	}
+	return freed;
+}
+
+std::size_t Grapheme::PoolSize()
+{
+	Pool& p = pool();
+	std::shared_lock lock(p.mutex);
+	return p.entries.size() - p.free.size();
+}
+
+bool Grapheme::HasClusters(const struct tb_cell* cells, std::size_t size)
+{
+	std::uint32_t any = 0;
+	#pragma omp simd reduction(|:any)
+	for (std::size_t i = 0; i < size; ++i)
+		any |= cells[i].ch;
+	return any & cluster_tag;
+}
+
+void Grapheme::ToBase(struct tb_cell* cells, std::size_t size)
+{
+	for (std::size_t i = 0; i < size; ++i)
+		cells[i].ch = Base(cells[i].ch);
+}
@@ -0,0 +1,174 @@
+#ifndef TERMBOXWIDGETS_GRAPHEME_HPP
+#define TERMBOXWIDGETS_GRAPHEME_HPP
+
+#include "Util.hpp"
+#include "termbox/src/termbox.h"
+
+////////////////////////////////////////////////
+/// \brief Grapheme clusters
+///
+/// A cell holds a single Char. Clusters made of several codepoints
+/// (combining marks, emoji ZWJ sequences, flags, ...) are interned
+/// in a pool shared by every frame, and the cell holds a tagged
+/// index into it:
+///  - bit 31 is set for clusters
+///  - bits 29-30 hold the width of the cluster, in cells
+///  - bits 0-28 hold the index in the pool
+///
+/// Clusters of a single codepoint are stored as is, so that text
+/// without clusters takes no more memory.
+///
+/// A cluster is freed by Collect once no TBChar holds it (TBChar counts
+/// its references) and no cell of the screen or of a surface held it
+/// during the last two frames (see Mark). Its index is then reused.
+/// Clusters in other cells (struct tb_cell copies) are not kept.
+/// \code{.cpp}
+/// const String s = U"é";
+/// const Char c = Grapheme::Intern(s); // Single cell, 'e' with an acute accent
+/// Grapheme::Get(c); // U"é"
+/// \endcode
+/// \ingroup Records
+////////////////////////////////////////////////
+namespace Grapheme
+{
+constexpr Char cluster_tag = 0x80000000;
+constexpr int width_shift = 29;
+constexpr Char index_mask = (1 << width_shift) - 1;
+
+////////////////////////////////////////////////
+/// \brief Check if a Char is a cluster
+///
+/// \param c The Char
+/// \returns True if c is an index in the pool
+////////////////////////////////////////////////
+constexpr bool IsCluster(Char c)
+{
+	return c & cluster_tag;
+}
+
+////////////////////////////////////////////////
+/// \brief Get the width of a Char
+///
+/// \param c The Char, either a codepoint or a cluster
+/// \returns The number of cells c takes, -1 for non printable codepoints
+/// \note Same as wcwidth() for codepoints, clusters need no lookup
+////////////////////////////////////////////////
+inline int Width(Char c)
+{
+	if (IsCluster(c))
+		return (c >> width_shift) & 0b11;
+	return wcwidth(c);
+}
+
+////////////////////////////////////////////////
+/// \brief Get the width of a cluster
+///
+/// \param cluster The codepoints of the cluster
+/// \returns The number of cells the cluster takes, -1 if its only
+///  codepoint is not printable
+////////////////////////////////////////////////
+int Width(StringView cluster);
+
+////////////////////////////////////////////////
+/// \brief Find the end of a cluster
+///
+/// Implements the most common rules of extended grapheme clusters
+/// (UAX #29): CR LF, combining marks and other extending codepoints,
+/// ZWJ sequences and pairs of regional indicators.
+/// \param s The string
+/// \param i The index of the first codepoint of the cluster
+/// \returns The index past the last codepoint of the cluster
+////////////////////////////////////////////////
+std::size_t Next(StringView s, std::size_t i);
+
+////////////////////////////////////////////////
+/// \brief Get the Char of a cluster
+///
+/// \param cluster The codepoints of the cluster
+/// \returns The codepoint if the cluster has a single one, a
+///  tagged index in the pool otherwise
+/// \throws Util::Exception if the pool holds index_mask + 1 clusters
+/// \note Thread safe
+////////////////////////////////////////////////
+Char Intern(StringView cluster);
+
+////////////////////////////////////////////////
+/// \brief Get the codepoints of a Char
+///
+/// \param c The Char, it must outlive the returned view when it is not a cluster,
+///  and be held by a TBChar (or marked) while the view is used when it is one
+/// \returns The codepoints of c, U+FFFD if the cluster was freed
+/// \note Thread safe
+////////////////////////////////////////////////
+StringView Get(const Char& c);
+
+////////////////////////////////////////////////
+/// \brief Hold a cluster, it is not freed until it is released
+///
+/// \param c The cluster, IsCluster(c) must be true
+/// \note Called by TBChar
+////////////////////////////////////////////////
+void Acquire(Char c);
+
+////////////////////////////////////////////////
+/// \brief Release a cluster held with Acquire
+///
+/// \param c The cluster, IsCluster(c) must be true
+////////////////////////////////////////////////
+void Release(Char c);
+
+////////////////////////////////////////////////
+/// \brief Keep the clusters held by cells through the next collections
+///
+/// \param cells The cells
+/// \param size The number of cells
+/// \note Termbox marks the screen and every surface on each frame
+////////////////////////////////////////////////
+void Mark(const struct tb_cell* cells, std::size_t size);
+
+////////////////////////////////////////////////
+/// \brief Start a new generation and free the unused clusters
+///
+/// Frees the clusters no TBChar holds, that were not interned,
+/// released or marked during the last two generations
+/// \returns The number of clusters freed
+/// \note Called by Termbox after every frame is displayed
+////////////////////////////////////////////////
+std::size_t Collect();
+
+////////////////////////////////////////////////
+/// \brief Get the number of clusters in the pool
+///
+/// \returns The number of clusters that are not freed
+////////////////////////////////////////////////
+std::size_t PoolSize();
+
+////////////////////////////////////////////////
+/// \brief Get the first codepoint of a Char
+///
+/// \param c The Char
+/// \returns The first codepoint of the cluster c, or c itself
+////////////////////////////////////////////////
+Char Base(Char c);
+
+////////////////////////////////////////////////
+/// \brief Check if cells hold clusters
+///
+/// \param cells The cells
+/// \param size The number of cells
+/// \returns True if any cell holds a cluster
+////////////////////////////////////////////////
+bool HasClusters(const struct tb_cell* cells, std::size_t size);
+
+////////////////////////////////////////////////
+/// \brief Replace clusters in cells by their first codepoint
+///
+/// Used when the cells are given to a renderer that only
+/// knows about codepoints
+/// \param cells The cells
+/// \param size The number of cells
+////////////////////////////////////////////////
+void ToBase(struct tb_cell* cells, std::size_t size);
+} // Grapheme
+
+#endif // TERMBOXWIDGETS_GRAPHEME_HPP
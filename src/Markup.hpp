@@ -0,0 +1,188 @@
+#ifndef TERMBOXWIDGETS_MARKUP_HPP
+#define TERMBOXWIDGETS_MARKUP_HPP
+
+#include "Draw.hpp"
+#include <array>
+
+////////////////////////////////////////////////
+/// \brief Styled text literals
+///
+/// The markup is parsed at compile time into segments of text, each
+/// with the style changes that apply to it. Only the arguments are
+/// handled at runtime, the result is written in a single allocation.
+///
+/// Tags:
+///  - `[b]`, `[i]`, `[u]`, `[r]`, `[s]`: bold, italic, underline, reverse, strike
+///  - `[fg=#rgb]`, `[fg=#rrggbb]`, `[fg=default]`: foreground color, `bg=` for the background
+///  - `[/]`: ends the last opened tag
+///  - `[[`: a literal `[`
+///
+/// Arguments are written with `%s` (`%%` for a literal `%`), they can be strings
+/// (anything convertible to StringView), TBStrings (which keep their style),
+/// Chars or integers.
+/// \code{.cpp}
+/// using namespace Markup::Literals;
+/// constexpr auto label = U"[b]Name[/]: [fg=#ff0]%s[/] (%s)"_markup;
+/// const TBString s = label.Build(Settings::default_text_style, name, age);
+/// label.Draw(Settings::default_text_style, pos, w, trailing, name, age);
+/// \endcode
+/// \note Malformed markup does not compile
+/// \ingroup Records
+////////////////////////////////////////////////
+namespace Markup
+{
+////////////////////////////////////////////////
+/// \brief String literal usable as a template argument
+///
+/// \tparam N The size of the literal, with its terminating null
+////////////////////////////////////////////////
+template <std::size_t N>
+struct Literal
+{
+	Char data[N];
+
+	consteval Literal(const Char (&s)[N])
+	{
+		std::copy(s, s + N, data);
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Get the number of codepoints
+	////////////////////////////////////////////////
+	consteval std::size_t Size() const
+	{
+		return N - 1;
+	}
+};
+
+////////////////////////////////////////////////
+/// \brief Style changes of a segment, relative to the base style
+////////////////////////////////////////////////
+struct Delta
+{
+	int s = TextStyle::None; ///< Added TextStyle flags
+	std::uint32_t fg = 0, bg = 0;
+	bool setFg = false, setBg = false;
+
+	////////////////////////////////////////////////
+	/// \brief Apply on a style
+	///
+	/// \param base The base style
+	/// \returns base with the changes applied
+	////////////////////////////////////////////////
+	constexpr TBStyle Apply(const TBStyle& base) const
+	{
+		return TBStyle(setFg ? Color(fg) : base.fg, setBg ? Color(bg) : base.bg, TextStyle(base.s | s));
+	}
+};
+
+////////////////////////////////////////////////
+/// \brief Part of the markup, either text or an argument
+////////////////////////////////////////////////
+struct Segment
+{
+	static constexpr std::size_t no_arg = static_cast<std::size_t>(-1);
+
+	std::size_t beg = 0, size = 0; ///< Range of the text, in the unescaped text
+	std::size_t arg = no_arg; ///< Index of the argument
+	Delta style;
+};
+
+////////////////////////////////////////////////
+/// \brief Parsed markup
+///
+/// \tparam S The markup
+////////////////////////////////////////////////
+template <Literal S>
+class Format
+{
+	////////////////////////////////////////////////
+	/// \brief Maximum number of nested tags
+	////////////////////////////////////////////////
+	static constexpr std::size_t s_maxDepth = 16;
+
+	struct Parsed
+	{
+		// A segment takes at least one codepoint of the markup
+		std::array<Char, S.Size() + 1> text{}; ///< Unescaped text of every segment
+		std::array<Segment, S.Size() + 1> segments{};
+		std::size_t segmentsSize = 0;
+		std::size_t args = 0;
+	};
+
+	static consteval Parsed Parse();
+	static consteval std::uint32_t ParseColor(const Char* s, std::size_t size);
+
+	static constexpr Parsed s_parsed = Parse();
+	// Instantiates s_parsed along with the class, so that malformed markup does not compile
+	static_assert(s_parsed.segmentsSize <= S.Size() + 1);
+
+	template <class T>
+	static std::size_t ArgSize(const T& a);
+	template <class T>
+	static void AppendArg(TBStringBuilder& out, const T& a, const TBStyle& style);
+
+public:
+	////////////////////////////////////////////////
+	/// \brief Number of arguments
+	////////////////////////////////////////////////
+	static constexpr std::size_t args = s_parsed.args;
+
+	////////////////////////////////////////////////
+	/// \brief Write the text
+	///
+	/// \param out The builder to append to, reserved once for the whole text
+	/// \param base The style of the text outside of tags
+	/// \param a The arguments
+	////////////////////////////////////////////////
+	template <class... Args>
+	static void Build(TBStringBuilder& out, const TBStyle& base, const Args&... a);
+
+	////////////////////////////////////////////////
+	/// \brief Get the text
+	///
+	/// \param base The style of the text outside of tags
+	/// \param a The arguments
+	/// \returns The text
+	////////////////////////////////////////////////
+	template <class... Args>
+	static TBString Build(const TBStyle& base, const Args&... a);
+
+	////////////////////////////////////////////////
+	/// \brief Draw the text on a single line
+	///
+	/// The text is written in a buffer kept by the calling thread,
+	/// so that drawing does not allocate once the buffer is large enough.
+	/// \param base The style of the text outside of tags
+	/// \param pos The begining position of the text
+	/// \param w The maximum width of the line
+	/// \param trailing The character to indicate that the line was too long
+	/// \param a The arguments
+	/// \returns The width of the drawn line and the index of the last character drawn
+	/// \see Draw::TextLine
+	////////////////////////////////////////////////
+	template <class... Args>
+	static std::pair<int, std::size_t> Draw(const TBStyle& base, Vec2i pos, int w, const TBChar& trailing, const Args&... a);
+};
+
+namespace Literals
+{
+////////////////////////////////////////////////
+/// \brief Parse markup
+///
+/// \tparam S The markup
+/// \returns The parsed markup
+////////////////////////////////////////////////
+template <Literal S>
+consteval Format<S> operator""_markup()
+{
+	return {};
+}
+} // Literals
+} // Markup
+
+/** @cond */
+#include "Markup.tcc"
+/** @endcond */
+
+#endif // TERMBOXWIDGETS_MARKUP_HPP
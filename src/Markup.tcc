@@ -0,0 +1,227 @@
+#include "Markup.hpp"
+#include <charconv>
+#include <tuple>
+
+template <Markup::Literal S>
+consteval std::uint32_t Markup::Format<S>::ParseColor(const Char* s, std::size_t size)
+{
+	const auto equals = [&](const char* lit)
+	{
+		std::size_t i = 0;
+		for (; lit[i] != '\0'; ++i)
+			if (i >= size || s[i] != static_cast<Char>(lit[i]))
+				return false;
+		return i == size;
+	};
+	if (equals("default"))
+		return TB_DEFAULT;
+
+	if (size == 0 || s[0] != U'#' || (size != 4 && size != 7))
+		throw Util::Exception("Markup: colors must be #rgb, #rrggbb or default");
+	const auto hex = [](Char c) -> std::uint32_t
+	{
+		if (c >= U'0' && c <= U'9')
+			return c - U'0';
+		if (c >= U'a' && c <= U'f')
+			return c - U'a' + 10;
+		if (c >= U'A' && c <= U'F')
+			return c - U'A' + 10;
+		throw Util::Exception("Markup: invalid hexadecimal digit in color");
+	};
+
+	std::uint32_t color = 0;
+	for (std::size_t i = 1; i < size; ++i)
+		color = size == 4 ? (color << 8) | hex(s[i]) * 0x11 : (color << 4) | hex(s[i]);
+	// 0 stands for the default color
+	return color == (TB_DEFAULT & 0xFFFFFF) ? 1 : color;
+}
+
+template <Markup::Literal S>
+consteval typename Markup::Format<S>::Parsed Markup::Format<S>::Parse()
+{
+	Parsed p;
+	std::size_t textSize = 0;
+	std::array<Delta, s_maxDepth> stack{};
+	std::size_t depth = 0;
+	Delta style;
+	bool open = false; // Whether text extends the last segment
+
+	const auto append = [&](Char c)
+	{
+		if (!open)
+		{
+			p.segments[p.segmentsSize++] = Segment{ textSize, 0, Segment::no_arg, style };
+			open = true;
+		}
+		p.text[textSize++] = c;
+		++p.segments[p.segmentsSize - 1].size;
+	};
+
+	const Char* s = S.data;
+	const std::size_t size = S.Size();
+	std::size_t i = 0;
+	while (i < size)
+	{
+		if (s[i] == U'%')
+		{
+			if (i + 1 < size && s[i + 1] == U'%')
+				append(U'%');
+			else if (i + 1 < size && s[i + 1] == U's')
+			{
+				p.segments[p.segmentsSize++] = Segment{ 0, 0, p.args++, style };
+				open = false;
+			}
+			else
+				throw Util::Exception("Markup: '%' must be followed by 's' or '%'");
+			i += 2;
+			continue;
+		}
+		if (s[i] != U'[')
+		{
+			append(s[i++]);
+			continue;
+		}
+		if (i + 1 < size && s[i + 1] == U'[')
+		{
+			append(U'[');
+			i += 2;
+			continue;
+		}
+
+		std::size_t end = i + 1;
+		while (end < size && s[end] != U']')
+			++end;
+		if (end == size)
+			throw Util::Exception("Markup: unterminated tag");
+		const Char* tag = s + i + 1;
+		const std::size_t tagSize = end - i - 1;
+		i = end + 1;
+
+		if (tagSize == 1 && tag[0] == U'/')
+		{
+			if (depth == 0)
+				throw Util::Exception("Markup: [/] does not close any tag");
+			style = stack[--depth];
+			open = false;
+			continue;
+		}
+		if (depth == s_maxDepth)
+			throw Util::Exception("Markup: too many nested tags");
+		stack[depth++] = style;
+		open = false;
+
+		if (tagSize == 1)
+		{
+			switch (tag[0])
+			{
+				case U'b': style.s |= TextStyle::Bold; break;
+				case U'i': style.s |= TextStyle::Italic; break;
+				case U'u': style.s |= TextStyle::Underline; break;
+				case U'r': style.s |= TextStyle::Reverse; break;
+				case U's': style.s |= TextStyle::Strike; break;
+				default: throw Util::Exception("Markup: unknown tag");
+			}
+		}
+		else if (tagSize > 3 && (tag[0] == U'f' || tag[0] == U'b') && tag[1] == U'g' && tag[2] == U'=')
+		{
+			const std::uint32_t color = ParseColor(tag + 3, tagSize - 3);
+			if (tag[0] == U'f')
+			{
+				style.fg = color;
+				style.setFg = true;
+			}
+			else
+			{
+				style.bg = color;
+				style.setBg = true;
+			}
+		}
+		else
+			throw Util::Exception("Markup: unknown tag");
+	}
+	if (depth != 0)
+		throw Util::Exception("Markup: unclosed tag");
+
+	return p;
+}
+
+template <Markup::Literal S>
+template <class T>
+std::size_t Markup::Format<S>::ArgSize(const T& a)
+{
+	if constexpr (std::is_convertible_v<const T&, TBStringView>)
+		return TBStringView(a).Size();
+	else if constexpr (std::is_convertible_v<const T&, StringView>)
+		return StringView(a).size();
+	else if constexpr (std::is_same_v<T, Char>)
+		return 1;
+	else if constexpr (std::is_integral_v<T>)
+		return std::numeric_limits<T>::digits10 + 2;
+	else
+		static_assert(std::is_integral_v<T>, "Markup: unsupported argument type");
+}
+
+template <Markup::Literal S>
+template <class T>
+void Markup::Format<S>::AppendArg(TBStringBuilder& out, const T& a, const TBStyle& style)
+{
+	if constexpr (std::is_convertible_v<const T&, TBStringView>)
+		out.Append(TBStringView(a));
+	else if constexpr (std::is_convertible_v<const T&, StringView>)
+		out.Append(StringView(a), style);
+	else if constexpr (std::is_same_v<T, Char>)
+		out.Append(TBChar(a, style));
+	else
+	{
+		char buf[std::numeric_limits<T>::digits10 + 2];
+		const char* end = std::to_chars(buf, buf + sizeof(buf), a).ptr;
+		for (const char* c = buf; c != end; ++c)
+			out.Append(TBChar(static_cast<Char>(*c), style));
+	}
+}
+
+template <Markup::Literal S>
+template <class... Args>
+void Markup::Format<S>::Build(TBStringBuilder& out, const TBStyle& base, const Args&... a)
+{
+	static_assert(sizeof...(Args) == args, "Markup: the number of arguments does not match the number of '%s'");
+
+	std::size_t size = 0;
+	for (std::size_t i = 0; i < s_parsed.segmentsSize; ++i)
+		size += s_parsed.segments[i].size;
+	out.Reserve(out.Size() + size + (ArgSize(a) + ... + 0));
+
+	const auto argv = std::forward_as_tuple(a...);
+	// Segments are known at compile time, the loop is unrolled
+	[&]<std::size_t... I>(std::index_sequence<I...>)
+	{
+		([&]
+		{
+			constexpr Segment seg = s_parsed.segments[I];
+			const TBStyle style = seg.style.Apply(base);
+			if constexpr (seg.arg == Segment::no_arg)
+				out.Append(StringView(s_parsed.text.data() + seg.beg, seg.size), style);
+			else
+				AppendArg(out, std::get<seg.arg>(argv), style);
+		}(), ...);
+	}(std::make_index_sequence<s_parsed.segmentsSize>{});
+}
+
+template <Markup::Literal S>
+template <class... Args>
+TBString Markup::Format<S>::Build(const TBStyle& base, const Args&... a)
+{
+	TBStringBuilder out;
+	Build(out, base, a...);
+	return out.Build();
+}
+
+template <Markup::Literal S>
+template <class... Args>
+std::pair<int, std::size_t> Markup::Format<S>::Draw(const TBStyle& base, Vec2i pos, int w, const TBChar& trailing, const Args&... a)
+{
+	thread_local TBStringBuilder out;
+	out.Clear();
+	Build(out, base, a...);
+	return ::Draw::TextLine(out.View(), pos, w, trailing);
+}
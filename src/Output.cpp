@@ -0,0 +1,609 @@
+#include "Output.hpp"
+#include "Cells.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <cerrno>
+
+// Never drawn, forces cells to be written
+static constexpr struct tb_cell s_invalid = { 0xFFFFFFFF, 0, 0 };
+
+// Synchronized update (DEC mode 2026)
+static constexpr char s_beginSync[] = "\x1b[?2026h";
+static constexpr char s_endSync[] = "\x1b[?2026l";
+
+// {style bit, SGR to set, SGR to reset}
+static constexpr int s_styles[5][3] = {
+	{ TextStyle::Bold, 1, 22 },
+	{ TextStyle::Italic, 3, 23 },
+	{ TextStyle::Underline, 4, 24 },
+	{ TextStyle::Reverse, 7, 27 },
+	{ TextStyle::Strike, 9, 29 },
+};
+
+static void appendInt(std::string& s, int n)
+{
+	char buf[12];
+	int i = sizeof(buf);
+	do
+	{
+		buf[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n != 0);
+	s.append(buf + i, sizeof(buf) - i);
+}
+
+static void appendUTF8(std::string& s, std::uint32_t c)
+{
+	if (c < 0x80)
+		s.push_back(static_cast<char>(c));
+	else if (c < 0x800)
+	{
+		s.push_back(static_cast<char>(0xC0 | (c >> 6)));
+		s.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+	}
+	else if (c < 0x10000)
+	{
+		s.push_back(static_cast<char>(0xE0 | (c >> 12)));
+		s.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+		s.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+	}
+	else
+	{
+		s.push_back(static_cast<char>(0xF0 | (c >> 18)));
+		s.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+		s.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+		s.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+	}
+}
+
+// Clusters are written as their codepoints, the terminal combines them
+static void appendChar(std::string& s, Char c)
+{
+	if (!Grapheme::IsCluster(c))
+		return appendUTF8(s, c);
+	for (const Char cp : Grapheme::Get(c))
+		appendUTF8(s, cp);
+}
+
+static void appendCSI(std::string& s, int n, char final)
+{
+	s.append("\x1b[");
+	if (n != 1)
+		appendInt(s, n);
+	s.push_back(final);
+}
+
+// Move the cursor on its row
+static void appendHorizontal(std::string& s, int from, int to)
+{
+	if (to == from)
+		return;
+	if (to == 0)
+	{
+		s.push_back('\r');
+		return;
+	}
+	if (to == from - 1)
+	{
+		s.push_back('\b');
+		return;
+	}
+
+	std::string rel;
+	if (to > from)
+		appendCSI(rel, to - from, 'C'); // CUF
+	else
+		appendCSI(rel, from - to, 'D'); // CUB
+	std::string abs;
+	appendCSI(abs, to + 1, 'G'); // CHA
+	s.append(rel.size() <= abs.size() ? rel : abs);
+}
+
+// SGR parameters of a (converted) color
+static void appendColor(std::string& s, std::uint32_t color, bool background)
+{
+	const std::uint32_t c = color & 0xFFFFFF;
+	if (c == (TB_DEFAULT & 0xFFFFFF))
+	{
+		s.append(background ? ";49" : ";39");
+		return;
+	}
+
+	switch (Color::GetMode())
+	{
+		case Color::COLORS_8:
+			s.append(background ? ";4" : ";3");
+			appendInt(s, c - TB_BLACK);
+			break;
+		case Color::COLORS_256:
+			s.append(background ? ";48;5;" : ";38;5;");
+			appendInt(s, c);
+			break;
+		default:
+			s.append(background ? ";48;2;" : ";38;2;");
+			appendInt(s, (c >> 16) & 0xFF);
+			s.push_back(';');
+			appendInt(s, (c >> 8) & 0xFF);
+			s.push_back(';');
+			appendInt(s, c & 0xFF);
+			break;
+	}
+}
+
+Output::Output():
+	m_cursor(-1, -1),
+	m_synchronized(false),
+	m_invalidate(false),
+	m_back(0),
+	m_ready(1),
+	m_render(2),
+	m_hasReady(false),
+	m_writing(false),
+	m_stop(false),
+	m_size(0, 0),
+	m_position(-1, -1),
+	m_cursorVisible(-1),
+	m_attributes(s_invalid),
+	m_attributesKnown(false)
+{
+	m_fd = open("/dev/tty", O_WRONLY | O_CLOEXEC);
+	if (m_fd < 0)
+		throw Util::Exception("Could not open the terminal : open() returned " + std::to_string(errno));
+}
+
+Output::~Output()
+{
+	SetThreaded(false);
+	close(m_fd);
+}
+
+void Output::MoveTo(std::string& out, Vec2i pos)
+{
+	if (pos == m_position)
+		return;
+
+	// Absolute move
+	std::string move = "\x1b[";
+	appendInt(move, pos[1] + 1);
+	if (pos[0] != 0)
+	{
+		move.push_back(';');
+		appendInt(move, pos[0] + 1);
+	}
+	move.push_back('H');
+
+	// Relative move
+	if (m_position[0] >= 0 && m_position[1] >= 0)
+	{
+		std::string rel;
+		const int dy = pos[1] - m_position[1];
+		// Termbox disables output processing, line feeds do not return the carriage
+		if (dy > 0 && dy <= 3)
+			rel.append(dy, '\n');
+		else if (dy > 0)
+			appendCSI(rel, dy, 'B'); // CUD
+		else if (dy < 0)
+			appendCSI(rel, -dy, 'A'); // CUU
+		appendHorizontal(rel, m_position[0], pos[0]);
+
+		if (rel.size() < move.size())
+			move = std::move(rel);
+	}
+
+	out.append(move);
+	m_position = pos;
+}
+
+void Output::Attributes(const struct tb_cell& cell)
+{
+	std::string params;
+	if (!m_attributesKnown)
+	{
+		params.append(";0");
+		m_attributes = { 0, TB_DEFAULT, TB_DEFAULT };
+		m_attributesKnown = true;
+	}
+
+	const std::uint32_t style = cell.fg >> 24;
+	const std::uint32_t current = m_attributes.fg >> 24;
+	for (const auto& [bit, set, reset] : s_styles)
+	{
+		if ((style & bit) == (current & bit))
+			continue;
+		params.push_back(';');
+		appendInt(params, (style & bit) ? set : reset);
+	}
+	if ((cell.fg & 0xFFFFFF) != (m_attributes.fg & 0xFFFFFF))
+		appendColor(params, cell.fg, false);
+	if ((cell.bg & 0xFFFFFF) != (m_attributes.bg & 0xFFFFFF))
+		appendColor(params, cell.bg, true);
+
+	m_attributes.fg = cell.fg;
+	m_attributes.bg = cell.bg;
+	if (params.empty())
+		return;
+
+	m_buffer.append("\x1b[");
+	m_buffer.append(params, 1);
+	m_buffer.push_back('m');
+}
+
+std::uint64_t Output::Hash(const struct tb_cell* cells, int w)
+{
+	static_assert(sizeof(struct tb_cell) == 3 * sizeof(std::uint32_t));
+	static constexpr std::uint64_t p1 = 0x9E3779B185EBCA87ULL;
+	static constexpr std::uint64_t p2 = 0xC2B2AE3D27D4EB4FULL;
+
+	// Four independent lanes, so that the main loop vectorizes
+	const std::uint32_t* words = reinterpret_cast<const std::uint32_t*>(cells);
+	const std::size_t n = 3 * static_cast<std::size_t>(w);
+	std::uint64_t lanes[4] = { p1, p2, ~p1, ~p2 };
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		#pragma omp simd
+		for (std::size_t l = 0; l < 4; ++l)
+		{
+			const std::uint64_t v = lanes[l] + words[i + l] * p2;
+			lanes[l] = (v << 31 | v >> 33) * p1;
+		}
+	}
+
+	std::uint64_t h = n * p1;
+	for (; i < n; ++i)
+		h = (h ^ words[i]) * p1;
+	for (const auto lane : lanes)
+	{
+		h = (h ^ lane) * p2;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+void Output::ScrollFront(const ScrollRegion& region)
+{
+	const int w = m_size[0];
+	const int h = region.bottom - region.top + 1;
+	const int n = std::abs(region.lines);
+	auto* rows = m_front.data() + region.top * w;
+	auto* hashes = m_frontHash.data() + region.top;
+	if (region.lines > 0)
+	{
+		std::copy(rows + n * w, rows + h * w, rows);
+		std::fill(rows + (h - n) * w, rows + h * w, s_invalid);
+		std::copy(hashes + n, hashes + h, hashes);
+		for (int y = h - n; y < h; ++y)
+			hashes[y] = Hash(rows + y * w, w);
+	}
+	else
+	{
+		std::copy_backward(rows, rows + (h - n) * w, rows + h * w);
+		std::fill(rows, rows + n * w, s_invalid);
+		std::copy_backward(hashes, hashes + (h - n), hashes + h);
+		for (int y = 0; y < n; ++y)
+			hashes[y] = Hash(rows + y * w, w);
+	}
+}
+
+std::size_t Output::Cost(const struct tb_cell* cells, const ScrollRegion& region)
+{
+	const int w = m_size[0];
+	std::size_t cost = 0;
+	for (int y = region.top; y <= region.bottom; ++y)
+	{
+		const int src = y + region.lines;
+		if (src < region.top || src > region.bottom)
+		{
+			cost += w;
+			continue;
+		}
+		if (m_frameHash[y] == m_frontHash[src])
+			continue;
+
+		cost += Cells::Compare(cells + y * w, m_front.data() + src * w, w, m_diff.data());
+	}
+	return cost;
+}
+
+std::size_t Output::Flush()
+{
+	const std::size_t syncSize = m_synchronized ? sizeof(s_beginSync) - 1 : 0;
+	struct iovec iov[4] = {
+		{ const_cast<char*>(s_beginSync), syncSize },
+		{ m_buffer.data(), m_buffer.size() },
+		{ m_tail.data(), m_tail.size() },
+		{ const_cast<char*>(s_endSync), syncSize },
+	};
+	const std::size_t size = m_buffer.size() + m_tail.size() + 2 * syncSize;
+
+	// Only retried on partial writes
+	std::size_t first = 0;
+	std::size_t left = size;
+	while (left != 0)
+	{
+		const ssize_t n = writev(m_fd, iov + first, 4 - first);
+		if (n < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			// Never leave the terminal waiting for the end of the frame
+			if (m_synchronized && left != size)
+				[[maybe_unused]] const auto r = write(m_fd, s_endSync, sizeof(s_endSync) - 1);
+			break;
+		}
+
+		left -= n;
+		for (std::size_t written = n; written != 0 && first < 4;)
+		{
+			const std::size_t len = std::min(written, iov[first].iov_len);
+			iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + len;
+			iov[first].iov_len -= len;
+			written -= len;
+			if (iov[first].iov_len == 0)
+				++first;
+		}
+	}
+
+	m_buffer.clear();
+	m_tail.clear();
+	return size;
+}
+
+void Output::Reset()
+{
+	m_front.assign(m_front.size(), s_invalid);
+	m_frontHash.assign(m_size[1], Hash(m_front.data(), m_size[0]));
+	m_position = Vec2i(-1, -1);
+	m_cursorVisible = -1;
+	m_attributesKnown = false;
+}
+
+void Output::Invalidate()
+{
+	// Reset by the thread that writes the next frame
+	m_invalidate = true;
+	m_scrolls.clear();
+}
+
+void Output::Scroll(Vec2i pos, Vec2i size, int lines)
+{
+	const int top = std::max(pos[1], 0);
+	const int bottom = pos[1] + size[1] - 1;
+	if (lines == 0 || bottom - top + 1 <= std::abs(lines))
+		return;
+
+	m_scrolls.push_back({ top, bottom, lines });
+}
+
+void Output::SetSynchronized(bool synchronized)
+{
+	m_synchronized = synchronized;
+}
+
+void Output::SetCursor(Vec2i pos)
+{
+	m_cursor = pos;
+}
+
+void Output::SetThreaded(bool threaded)
+{
+	if (threaded == m_thread.joinable())
+		return;
+
+	if (threaded)
+	{
+		m_stop = false;
+		m_thread = std::thread(&Output::RenderThread, this);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	m_thread.join();
+}
+
+void Output::RenderThread()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		m_cv.wait(lock, [this]{ return m_hasReady || m_stop; });
+		// The last frame is written before stopping
+		if (!m_hasReady)
+			break;
+
+		std::swap(m_ready, m_render);
+		m_hasReady = false;
+		m_writing = true;
+		lock.unlock();
+
+		const Frame& frame = m_frames[m_render];
+		Write(frame.cells.data(), frame.size, frame.cursor, frame.scrolls);
+
+		lock.lock();
+		m_writing = false;
+		m_cv.notify_all();
+	}
+}
+
+void Output::Present(const struct tb_cell* cells, Vec2i size)
+{
+	if (!m_thread.joinable())
+	{
+		Write(cells, size, m_cursor, m_scrolls);
+		m_scrolls.clear();
+		return;
+	}
+
+	// Only this thread uses the back frame
+	Frame& frame = m_frames[m_back];
+	frame.cells.assign(cells, cells + size[0] * size[1]);
+	frame.size = size;
+	frame.cursor = m_cursor;
+	frame.scrolls.swap(m_scrolls);
+	m_scrolls.clear();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// The previous frame is dropped, but the terminal has not scrolled yet
+		if (m_hasReady)
+		{
+			const auto& scrolls = m_frames[m_ready].scrolls;
+			frame.scrolls.insert(frame.scrolls.begin(), scrolls.cbegin(), scrolls.cend());
+			++m_stats.dropped;
+		}
+		std::swap(m_back, m_ready);
+		m_hasReady = true;
+	}
+	m_cv.notify_all();
+}
+
+void Output::Wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cv.wait(lock, [this]{ return !m_hasReady && !m_writing; });
+}
+
+void Output::Write(const struct tb_cell* cells, Vec2i size, Vec2i cursor, const std::vector<ScrollRegion>& scrolls)
+{
+	const std::size_t len = size[0] * size[1];
+	if (size != m_size)
+	{
+		m_size = size;
+		m_front.resize(len);
+		m_frameHash.resize(m_size[1]);
+		m_diff.resize(Cells::BitmapWords(m_size[0]));
+		Reset();
+	}
+	if (m_invalidate.exchange(false))
+		Reset();
+	std::size_t frameCells = 0;
+
+	for (int y = 0; y < m_size[1]; ++y)
+		m_frameHash[y] = Hash(cells + y * m_size[0], m_size[0]);
+
+	// Let the terminal move the rows, when it saves writing cells
+	for (auto region : scrolls)
+	{
+		region.bottom = std::min(region.bottom, m_size[1] - 1);
+		if (region.bottom - region.top + 1 <= std::abs(region.lines))
+			continue;
+		if (Cost(cells, region) >= Cost(cells, { region.top, region.bottom, 0 }))
+			continue;
+
+		// Setting the margins moves the cursor home
+		m_buffer.append("\x1b[");
+		appendInt(m_buffer, region.top + 1);
+		m_buffer.push_back(';');
+		appendInt(m_buffer, region.bottom + 1);
+		m_buffer.push_back('r');
+		m_position = Vec2i(0, 0);
+
+		if (region.lines > 0)
+		{
+			MoveTo(m_buffer, Vec2i(0, region.bottom));
+			for (int i = 0; i < region.lines; ++i)
+				m_buffer.append("\x1b" "D"); // IND
+		}
+		else
+		{
+			MoveTo(m_buffer, Vec2i(0, region.top));
+			for (int i = 0; i < -region.lines; ++i)
+				m_buffer.append("\x1b" "M"); // RI
+		}
+		m_buffer.append("\x1b[r");
+		m_position = Vec2i(0, 0);
+
+		ScrollFront(region);
+	}
+
+	m_frame.assign(cells, cells + len);
+	Color::Convert(m_frame.data(), len);
+
+	for (int y = 0; y < m_size[1]; ++y)
+	{
+		// Once written, the row on the terminal is the same as in the frame
+		if (m_frameHash[y] == m_frontHash[y])
+			continue;
+		m_frontHash[y] = m_frameHash[y];
+
+		const std::size_t row = y * m_size[0];
+		if (!Cells::Compare(cells + row, m_front.data() + row, m_size[0], m_diff.data()))
+			continue;
+
+		for (int x = 0; x < m_size[0];)
+		{
+			const std::size_t i = x + row;
+			const int width = std::max(Grapheme::Width(cells[i].ch), 1);
+			const bool wide = width > 1 && x + 1 < m_size[0];
+			if (!Cells::Test(m_diff.data(), x) && (!wide || !Cells::Test(m_diff.data(), x + 1)))
+			{
+				++x;
+				continue;
+			}
+
+			// Rewriting a few unchanged cells is shorter than moving over them
+			if (m_position[1] == y && m_position[0] < x && x - m_position[0] <= 3)
+			{
+				const std::size_t beg = m_position[0] + y * m_size[0];
+				bool rewrite = m_attributesKnown;
+				for (std::size_t j = beg; j < i && rewrite; ++j)
+				{
+					rewrite = Grapheme::Width(m_frame[j].ch) == 1 &&
+						m_frame[j].fg == m_attributes.fg && m_frame[j].bg == m_attributes.bg;
+				}
+				if (rewrite)
+				{
+					for (std::size_t j = beg; j < i; ++j)
+						appendChar(m_buffer, m_frame[j].ch);
+					m_position[0] = x;
+				}
+			}
+
+			const struct tb_cell& cell = m_frame[i];
+			Attributes(cell);
+			MoveTo(m_buffer, Vec2i(x, y));
+			appendChar(m_buffer, Grapheme::Width(cell.ch) < 1 ? U' ' : cell.ch);
+			++frameCells;
+
+			// The continuation cell of wide characters is not written
+			const int next = std::min(x + width, m_size[0]);
+			std::copy(cells + i, cells + i + (next - x), m_front.begin() + i);
+			x = next;
+			// Past the last column, the terminal may or may not have wrapped
+			m_position = x < m_size[0] ? Vec2i(x, y) : Vec2i(-1, -1);
+		}
+	}
+
+	if (cursor[0] < 0 || cursor[1] < 0)
+	{
+		if (m_cursorVisible != 0)
+			m_tail.append("\x1b[?25l");
+		m_cursorVisible = 0;
+	}
+	else
+	{
+		MoveTo(m_tail, cursor);
+		if (m_cursorVisible != 1)
+			m_tail.append("\x1b[?25h");
+		m_cursorVisible = 1;
+	}
+
+	const std::size_t bytes = m_buffer.empty() && m_tail.empty() ? 0 : Flush();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stats.frameBytes = bytes;
+	m_stats.frameCells = frameCells;
+	m_stats.totalBytes += bytes;
+	++m_stats.frames;
+}
+
+Output::Statistics Output::GetStatistics()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
@@ -0,0 +1,183 @@
+#ifndef TERMBOXWIDGETS_OUTPUT_HPP
+#define TERMBOXWIDGETS_OUTPUT_HPP
+
+#include "Text.hpp"
+#include <string>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+////////////////////////////////////////////////
+/// \brief Native terminal output
+///
+/// Replaces tb_render() when enabled with Termbox::SetNativeOutput.
+/// Keeps a copy of what the terminal displays and only writes the
+/// cells that changed. Regions that were declared as scrolled are
+/// scrolled by the terminal itself, so that only the rows they expose
+/// have to be sent.
+///
+/// Rows are compared through a 64 bit hash first, so that unchanged
+/// rows are skipped without comparing their cells. The cells of the
+/// other rows are compared all at once, see Cells::Compare.
+///
+/// Only the attributes that differ from the previous cell are sent,
+/// cursor movements use the shortest sequence available, and each
+/// frame is written with a single writev(), wrapped in a synchronized
+/// update when enabled.
+///
+/// Frames can be written by a dedicated thread (see SetThreaded), so that
+/// a slow terminal does not stall input handling.
+/// \note Termbox still handles the terminal's initialization and input
+////////////////////////////////////////////////
+class Output
+{
+	struct ScrollRegion
+	{
+		int top, bottom; ///< Rows of the region, inclusive
+		int lines; ///< > 0 if the content moved up
+	};
+
+public:
+	////////////////////////////////////////////////
+	/// \brief Output counters
+	////////////////////////////////////////////////
+	struct Statistics
+	{
+		std::size_t frameBytes = 0; ///< Bytes written for the last frame
+		std::size_t frameCells = 0; ///< Cells written for the last frame
+		std::size_t totalBytes = 0; ///< Bytes written since the output was created
+		std::size_t frames = 0; ///< Frames written since the output was created
+		std::size_t dropped = 0; ///< Frames replaced by a newer one before being written
+	};
+
+private:
+	struct Frame
+	{
+		std::vector<struct tb_cell> cells;
+		Vec2i size = Vec2i(0, 0);
+		Vec2i cursor = Vec2i(-1, -1);
+		std::vector<ScrollRegion> scrolls;
+	};
+
+	int m_fd;
+	Vec2i m_cursor; ///< Requested cursor position, negative to hide it
+	std::vector<ScrollRegion> m_scrolls; ///< Declared since the last frame
+	std::atomic<bool> m_synchronized;
+	std::atomic<bool> m_invalidate;
+
+	// Triple buffer, between Present() and the render thread
+	std::array<Frame, 3> m_frames;
+	std::size_t m_back, m_ready, m_render; ///< Indices in m_frames
+	bool m_hasReady; ///< m_ready holds a frame that has not been written
+	bool m_writing; ///< The render thread is writing m_render
+	bool m_stop;
+	std::thread m_thread;
+	std::mutex m_mutex; ///< For the triple buffer and m_stats
+	std::condition_variable m_cv;
+	Statistics m_stats;
+
+	// Owned by the thread that writes
+	Vec2i m_size;
+	Vec2i m_position; ///< Position of the terminal's cursor, negative if unknown
+	int m_cursorVisible; ///< -1 if unknown
+	struct tb_cell m_attributes; ///< Current attributes of the terminal
+	bool m_attributesKnown;
+	std::vector<struct tb_cell> m_front; ///< What the terminal displays
+	std::vector<struct tb_cell> m_frame; ///< Converted frame
+	std::vector<std::uint64_t> m_frontHash; ///< Hash of each row of m_front
+	std::vector<std::uint64_t> m_frameHash; ///< Hash of each row of the frame
+	std::vector<std::uint64_t> m_diff; ///< Bitmap of the cells of a row that differ from m_front
+	std::string m_buffer; ///< Cells and scrolling
+	std::string m_tail; ///< Cursor
+
+	void Reset();
+	void Write(const struct tb_cell* cells, Vec2i size, Vec2i cursor, const std::vector<ScrollRegion>& scrolls);
+	void RenderThread();
+	void MoveTo(std::string& out, Vec2i pos);
+	void Attributes(const struct tb_cell& cell);
+	void ScrollFront(const ScrollRegion& region);
+	std::size_t Cost(const struct tb_cell* cells, const ScrollRegion& region);
+	static std::uint64_t Hash(const struct tb_cell* cells, int w);
+	std::size_t Flush();
+public:
+	////////////////////////////////////////////////
+	/// \brief Constructor
+	///
+	/// \throws Util::Exception If the terminal could not be opened
+	////////////////////////////////////////////////
+	Output();
+
+	////////////////////////////////////////////////
+	/// \brief Destructor
+	////////////////////////////////////////////////
+	~Output();
+
+	////////////////////////////////////////////////
+	/// \brief Forget what the terminal displays
+	///
+	/// The next frame will be written entirely
+	////////////////////////////////////////////////
+	void Invalidate();
+
+	////////////////////////////////////////////////
+	/// \brief Declare that a region of the screen scrolled
+	///
+	/// \param pos The position of the region
+	/// \param size The size of the region
+	/// \param lines The number of lines the content moved up by,
+	///  negative if it moved down
+	/// \note The whole width of the rows is scrolled, cells outside of the
+	///  region are then rewritten if they differ. The scroll is only sent if it
+	///  requires less cells to be written than without it.
+	////////////////////////////////////////////////
+	void Scroll(Vec2i pos, Vec2i size, int lines);
+
+	////////////////////////////////////////////////
+	/// \brief Set the cursor's position
+	///
+	/// \param pos The cursor position, negative to hide the cursor
+	////////////////////////////////////////////////
+	void SetCursor(Vec2i pos);
+
+	////////////////////////////////////////////////
+	/// \brief Wrap frames in synchronized updates
+	///
+	/// \param synchronized True if the terminal supports DEC mode 2026
+	////////////////////////////////////////////////
+	void SetSynchronized(bool synchronized);
+
+	////////////////////////////////////////////////
+	/// \brief Write frames from a dedicated thread
+	///
+	/// Present() then only copies the frame. If the terminal is slower
+	/// than the frames are presented, intermediate frames are dropped.
+	/// \param threaded True to start the render thread, false to stop it
+	///  once the last frame is written
+	/// \note The color mode must not be changed while a frame is written
+	////////////////////////////////////////////////
+	void SetThreaded(bool threaded);
+
+	////////////////////////////////////////////////
+	/// \brief Write a frame to the terminal
+	///
+	/// \param cells The cells of the frame, with 24 bit colors
+	/// \param size The size of the frame
+	////////////////////////////////////////////////
+	void Present(const struct tb_cell* cells, Vec2i size);
+
+	////////////////////////////////////////////////
+	/// \brief Wait until every presented frame is written
+	////////////////////////////////////////////////
+	void Wait();
+
+	////////////////////////////////////////////////
+	/// \brief Get the output counters
+	///
+	/// \returns A copy of the counters
+	////////////////////////////////////////////////
+	Statistics GetStatistics();
+};
+
+#endif // TERMBOXWIDGETS_OUTPUT_HPP
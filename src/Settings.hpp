@@ -13,6 +13,13 @@ namespace Colors
 {
 	constexpr Color background = COLOR_DEFAULT;
 	constexpr Color foreground = 0xFFFFFF;
+
+	////////////////////////////////////////////////
+	/// \brief Colors that the terminal's default colors are blended as
+	/// \see Draw::Blend
+	////////////////////////////////////////////////
+	constexpr Color blend_foreground = 0xFFFFFF;
+	constexpr Color blend_background = 0x000000;
 }
 
 ////////////////////////////////////////////////
@@ -74,6 +81,14 @@ constexpr long int event_clock_resolution = 16666; // 1/60 s
 
 constexpr bool enable_repeat = true;
 
+// Wrap frames in synchronized updates (DEC mode 2026) when the terminal supports it
+constexpr bool synchronized_output = true;
+// Time to wait for the terminal to answer queries at startup, in milliseconds
+constexpr int terminal_query_timeout = 100;
+
+// Opacity of the shadows drawn by Draw::Shadow, from 0 to 255
+constexpr std::uint8_t shadow_alpha = 96;
+
 
 }
 
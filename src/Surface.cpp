@@ -0,0 +1,109 @@
+#include "Surface.hpp"
+#include "Cells.hpp"
+#include <unordered_set>
+#include <mutex>
+
+// Every surface, to mark the clusters of their cells
+static std::unordered_set<const CellSurface*> s_surfaces;
+static std::mutex s_surfacesMutex;
+
+// Every cell holds the same character: if it is wide, every other cell is covered
+static void fillWide(std::vector<std::uint64_t>& wide, Vec2i size, const struct tb_cell& fill)
+{
+	std::fill(wide.begin(), wide.end(), 0);
+	if (Grapheme::Width(fill.ch) < 2)
+		return;
+
+	const std::size_t stride = Cells::BitmapWords(size[0] + 1);
+	for (int y = 0; y < size[1]; ++y)
+		for (int x = 1; x <= size[0]; x += 2)
+			wide[x / 64 + y * stride] |= std::uint64_t(1) << (x % 64);
+}
+
+CellSurface::CellSurface():
+	m_size(0, 0)
+{
+	std::lock_guard<std::mutex> lock(s_surfacesMutex);
+	s_surfaces.insert(this);
+}
+
+CellSurface::CellSurface(Vec2i size, const TBChar& fill):
+	CellSurface()
+{
+	Resize(size, fill);
+}
+
+CellSurface::CellSurface(const CellSurface& surface):
+	m_cells(surface.m_cells), m_wide(surface.m_wide), m_size(surface.m_size)
+{
+	std::lock_guard<std::mutex> lock(s_surfacesMutex);
+	s_surfaces.insert(this);
+}
+
+CellSurface::CellSurface(CellSurface&& surface):
+	m_cells(std::move(surface.m_cells)), m_wide(std::move(surface.m_wide)), m_size(surface.m_size)
+{
+	std::lock_guard<std::mutex> lock(s_surfacesMutex);
+	s_surfaces.insert(this);
+}
+
+CellSurface::~CellSurface()
+{
+	std::lock_guard<std::mutex> lock(s_surfacesMutex);
+	s_surfaces.erase(this);
+}
+
+void CellSurface::Resize(Vec2i size, const TBChar& fill)
+{
+	m_size = Vec2i(std::max(size[0], 0), std::max(size[1], 0));
+	m_cells.assign(m_size[0] * m_size[1], fill());
+	m_wide.resize(Cells::BitmapWords(m_size[0] + 1) * m_size[1]);
+	fillWide(m_wide, m_size, fill());
+}
+
+void CellSurface::Clear(const TBChar& fill)
+{
+	Cells::Fill(m_cells.data(), m_cells.size(), fill());
+	fillWide(m_wide, m_size, fill());
+}
+
+const Vec2i& CellSurface::GetSize() const
+{
+	return m_size;
+}
+
+struct tb_cell* CellSurface::Data()
+{
+	return m_cells.data();
+}
+
+const struct tb_cell* CellSurface::Data() const
+{
+	return m_cells.data();
+}
+
+std::uint64_t* CellSurface::WideData()
+{
+	return m_wide.data();
+}
+
+const std::uint64_t* CellSurface::WideData() const
+{
+	return m_wide.data();
+}
+
+struct tb_cell CellSurface::At(Vec2i pos) const
+{
+	const auto& [x, y] = pos;
+	if (x < 0 || y < 0 || x >= m_size[0] || y >= m_size[1])
+		return { 0, 0, 0 };
+
+	return m_cells[x + y * m_size[0]];
+}
+
+void CellSurface::MarkClusters()
+{
+	std::lock_guard<std::mutex> lock(s_surfacesMutex);
+	for (const CellSurface* surface : s_surfaces)
+		Grapheme::Mark(surface->m_cells.data(), surface->m_cells.size());
+}
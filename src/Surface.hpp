@@ -0,0 +1,121 @@
+#ifndef TERMBOXWIDGETS_SURFACE_HPP
+#define TERMBOXWIDGETS_SURFACE_HPP
+
+#include "Draw.hpp"
+
+////////////////////////////////////////////////
+/// \brief An owned 2D array of cells
+///
+/// A surface can be drawn into with the Draw primitives
+/// (see Draw::PushTarget), and copied to the screen or
+/// to another surface with Draw::Blit.
+/// \code{.cpp}
+/// CellSurface logo({ 20, 5 });
+/// Draw::PushTarget(logo);
+/// Draw::Border(border, { 0, 0 }, { 19, 4 });
+/// Draw::TextLine(name, { 1, 1 }, 18, trailing);
+/// Draw::PopTarget();
+///
+/// // Then, every time the window is drawn
+/// Draw::Blit(logo, pos);
+/// \endcode
+////////////////////////////////////////////////
+class CellSurface
+{
+	std::vector<struct tb_cell> m_cells;
+	std::vector<std::uint64_t> m_wide; ///< See WideData
+	Vec2i m_size;
+
+public:
+	////////////////////////////////////////////////
+	/// \brief Default constructor
+	////////////////////////////////////////////////
+	CellSurface();
+
+	////////////////////////////////////////////////
+	/// \brief Copy constructor
+	////////////////////////////////////////////////
+	CellSurface(const CellSurface& surface);
+
+	////////////////////////////////////////////////
+	/// \brief Move constructor
+	////////////////////////////////////////////////
+	CellSurface(CellSurface&& surface);
+
+	////////////////////////////////////////////////
+	/// \brief Destructor
+	////////////////////////////////////////////////
+	~CellSurface();
+
+	CellSurface& operator=(const CellSurface& surface) = default;
+	CellSurface& operator=(CellSurface&& surface) = default;
+
+	////////////////////////////////////////////////
+	/// \brief Constructor
+	///
+	/// \param size The size of the surface
+	/// \param fill The character to fill the surface with
+	////////////////////////////////////////////////
+	CellSurface(Vec2i size, const TBChar& fill = TBChar(Settings::fill_character, Settings::default_text_style));
+
+	////////////////////////////////////////////////
+	/// \brief Resize the surface
+	///
+	/// \param size The new size of the surface
+	/// \param fill The character to fill the surface with
+	/// \note The content of the surface is lost
+	////////////////////////////////////////////////
+	void Resize(Vec2i size, const TBChar& fill = TBChar(Settings::fill_character, Settings::default_text_style));
+
+	////////////////////////////////////////////////
+	/// \brief Fill the whole surface
+	///
+	/// \param fill The character to fill the surface with
+	////////////////////////////////////////////////
+	void Clear(const TBChar& fill = TBChar(Settings::fill_character, Settings::default_text_style));
+
+	////////////////////////////////////////////////
+	/// \brief Get the size of the surface
+	///
+	/// \returns The size of the surface
+	////////////////////////////////////////////////
+	const Vec2i& GetSize() const;
+
+	////////////////////////////////////////////////
+	/// \brief Get the cells of the surface
+	///
+	/// \returns The cells, stored row by row
+	////////////////////////////////////////////////
+	struct tb_cell* Data();
+	const struct tb_cell* Data() const;
+
+	////////////////////////////////////////////////
+	/// \brief Get the cells covered by the second half of a wide character
+	///
+	/// \returns A bitmap of `GetSize()[0] + 1` bits per row, rounded up to
+	///  64 bits. Bit x of a row is set if the cell at x - 1 holds a wide
+	///  character. It is maintained by the Draw primitives.
+	/// \see Draw::IsContinuation
+	////////////////////////////////////////////////
+	std::uint64_t* WideData();
+	const std::uint64_t* WideData() const;
+
+	////////////////////////////////////////////////
+	/// \brief Get the cell at
+	///
+	/// \param pos The position of cell
+	/// \returns The cell at pos, or an empty cell if pos is invalid
+	////////////////////////////////////////////////
+	struct tb_cell At(Vec2i pos) const;
+
+	////////////////////////////////////////////////
+	/// \brief Keep the clusters of every surface
+	///
+	/// Cells do not hold their cluster, surfaces are marked so that
+	/// what they hold is not freed (see Grapheme::Collect)
+	/// \note Called by Termbox after drawing, while no surface is drawn to
+	////////////////////////////////////////////////
+	static void MarkClusters();
+};
+
+#endif // TERMBOXWIDGETS_SURFACE_HPP
@@ -1,5 +1,149 @@
 #include "Termbox.hpp"
 #include "Widgets.hpp"
+#include "Output.hpp"
+#include "Cells.hpp"
+#include "ANSI.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <utility>
+#include <optional>
+#include <string_view>
+
+static constexpr char s_beginSync[] = "\x1b[?2026h";
+static constexpr char s_endSync[] = "\x1b[?2026l";
+
+// Removes the first "CSI ? <params> <final>" from reply whose parameters
+// start with prefix and match the given characters, returns its parameters
+static std::optional<std::string> takeReply(std::string& reply, std::string_view prefix, std::string_view params, std::string_view final)
+{
+	for (auto pos = reply.find("\x1b[?"); pos != std::string::npos; pos = reply.find("\x1b[?", pos + 1))
+	{
+		const auto begin = pos + 3;
+		const auto last = reply.find_first_not_of(params, begin);
+		if (last == std::string::npos || reply.compare(begin, prefix.size(), prefix) != 0 || reply.compare(last, final.size(), final) != 0)
+			continue;
+
+		std::string found = reply.substr(begin, last - begin);
+		reply.erase(pos, last + final.size() - pos);
+		return found;
+	}
+	return {};
+}
+
+// Asks the terminal wether it supports synchronized updates (DEC mode 2026)
+// Bytes typed before the answers arrive are read along with them, they are
+// left in typeahead as they were received so that they are not lost
+static bool querySynchronized(int fd, std::string& typeahead)
+{
+	// DECRQM, followed by DA1 which every terminal answers, after DECRQM's answer if any
+	static constexpr char query[] = "\x1b[?2026$p\x1b[c";
+	if (write(fd, query, sizeof(query) - 1) != sizeof(query) - 1)
+		return false;
+
+	std::string reply;
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Settings::terminal_query_timeout);
+	std::optional<std::string> mode;
+	while (true)
+	{
+		// DA1's answer is "CSI ? ... c", DECRQM's "CSI ? 2026 ; Ps $ y"
+		if (!mode)
+			mode = takeReply(reply, "2026;", "0123456789;", "$y");
+		if (takeReply(reply, "", "0123456789;", "c"))
+			break;
+
+		const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (left <= 0 || poll(&pfd, 1, static_cast<int>(left)) <= 0)
+			break;
+
+		char buf[64];
+		const ssize_t n = read(fd, buf, sizeof(buf));
+		if (n <= 0)
+			break;
+		reply.append(buf, n);
+	}
+	typeahead = std::move(reply);
+
+	// Ps is 0 if the mode is not recognized, 1 (set), 2 (reset),
+	// 3 (permanently set) or 4 (permanently reset) otherwise
+	return mode && mode->size() == 6 && (*mode)[5] >= '1' && (*mode)[5] <= '4';
+}
+
+// Puts bytes back in the terminal's input queue, where termbox reads
+// them as if they were typed. Returns what could not be put back: the
+// kernel may forbid it (TIOCSTI)
+static std::string pushInput(int fd, std::string_view input)
+{
+	for (std::size_t i = 0; i < input.size(); ++i)
+	{
+		if (ioctl(fd, TIOCSTI, &input[i]) < 0)
+			return std::string(input.substr(i));
+	}
+	return {};
+}
+
+// Terminal to send the end of synchronized updates to if the program
+// dies during a frame, -1 if there is none
+static volatile int s_syncTty = -1;
+
+static void endSync()
+{
+	if (s_syncTty >= 0)
+		[[maybe_unused]] const auto r = write(s_syncTty, s_endSync, sizeof(s_endSync) - 1);
+}
+
+static void endSyncSignal(int sig)
+{
+	endSync();
+	std::signal(sig, SIG_DFL);
+	std::raise(sig);
+}
+
+// Ends a pending synchronized update on exit() and on fatal signals
+// (std::terminate raises SIGABRT). Signals the program handles itself are
+// left alone, as is SIGKILL: terminals then end the update after a timeout.
+static void installSyncHandlers(int fd)
+{
+	s_syncTty = fd;
+
+	static bool installed = false;
+	if (installed)
+		return;
+	installed = true;
+
+	std::atexit(endSync);
+	for (const int sig : { SIGABRT, SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGTERM, SIGHUP, SIGINT, SIGQUIT })
+	{
+		struct sigaction current;
+		if (sigaction(sig, nullptr, &current) == 0 && current.sa_handler == SIG_DFL)
+			std::signal(sig, endSyncSignal);
+	}
+}
+
+// Wraps a frame rendered by termbox in a synchronized update. The end is
+// sent even if rendering throws, so that the terminal is never left frozen
+class SyncGuard
+{
+	int m_fd;
+public:
+	SyncGuard(int fd):
+		m_fd(fd)
+	{
+		if (m_fd >= 0)
+			[[maybe_unused]] const auto r = write(m_fd, s_beginSync, sizeof(s_beginSync) - 1);
+	}
+
+	~SyncGuard()
+	{
+		if (m_fd >= 0)
+			[[maybe_unused]] const auto r = write(m_fd, s_endSync, sizeof(s_endSync) - 1);
+	}
+};
 
 Termbox::Termbox(Color::COLOR_MODE mode, Color bg, std::function<bool(void)> predicate)
 {
@@ -11,15 +155,31 @@ Termbox::Termbox(Color::COLOR_MODE mode, Color bg, std::function<bool(void)> pre
 	tb_enable_mouse();
 
 	s_dim = Vec2i( tb_width(), tb_height() );
+	Draw::ClearWide();
 	s_predicate = predicate;
 	tb_set_clear_attributes(COLOR_DEFAULT(), bg());
 
+	m_parallel = false;
+
+	// Termbox has put the terminal in raw mode, the answer is not echoed
+	m_tty = open("/dev/tty", O_RDWR | O_CLOEXEC);
+	if (Settings::synchronized_output && m_tty >= 0)
+	{
+		m_ctx.synchronized = querySynchronized(m_tty, m_typeahead);
+		m_typeahead = pushInput(m_tty, m_typeahead);
+	}
+	if (m_ctx.synchronized)
+		installSyncHandlers(m_tty);
+
 	m_this = this;
 }
 
 Termbox::~Termbox()
 {
-	tb_shutdown();
+	Close();
+	s_syncTty = -1;
+	if (m_tty >= 0)
+		close(m_tty);
 }
 
 void Termbox::ReOpen()
@@ -31,8 +191,11 @@ void Termbox::ReOpen()
 	tb_enable_mouse();
 
 	s_dim = Vec2i( tb_width(), tb_height() );
+	Draw::ClearWide();
 	tb_set_clear_attributes(COLOR_DEFAULT(), m_this->m_bg());
 	m_this->m_ctx.clear = true;
+	if (m_this->m_output)
+		m_this->m_output->Invalidate();
 
 	// Sizes might have changed, plus it's a nice way to force redraw everything
 	Resize();
@@ -40,6 +203,11 @@ void Termbox::ReOpen()
 
 void Termbox::Close()
 {
+	if (m_this->m_output)
+		m_this->m_output->Wait();
+	// In case a frame was interrupted
+	if (m_this->m_ctx.synchronized)
+		[[maybe_unused]] const auto r = write(m_this->m_tty, s_endSync, sizeof(s_endSync) - 1);
 	tb_shutdown();
 }
 
@@ -50,13 +218,17 @@ void Termbox::Draw(Drawable& d)
 
 void Termbox::Clear()
 {
-	tb_clear_buffer();
+	// Same cell as tb_clear_buffer(), without the per-cell loop
+	const struct tb_cell blank = { U' ', COLOR_DEFAULT(), m_this->m_bg() };
+	Cells::Fill(tb_cell_buffer(), std::size_t(tb_width()) * tb_height(), blank);
+	Draw::ClearWide();
 }
 
 void Termbox::Resize()
 {
 	tb_clear_screen();
 	tb_clear_buffer();
+	Draw::ClearWide();
 	s_dim = { tb_width(), tb_height() };
 	m_this->m_ctx.clear = true;
 
@@ -69,10 +241,73 @@ void Termbox::Resize()
 
 void Termbox::Display()
 {
-	tb_render();
+	if (m_this->m_output)
+		m_this->m_output->Present(tb_cell_buffer(), s_dim);
+	else
+	{
+		const SyncGuard guard(m_this->m_ctx.synchronized ? m_this->m_tty : -1);
+		// The cell buffer keeps 24 bit colors and clusters so that cells that
+		// are not redrawn remain valid for the next frame
+		struct tb_cell* buffer = tb_cell_buffer();
+		const std::size_t size = s_dim[0] * s_dim[1];
+		const bool convert = Color::GetMode() != Color::COLORS_TRUECOLOR;
+		// Termbox only writes single codepoints
+		const bool clusters = Grapheme::HasClusters(buffer, size);
+		if (convert || clusters)
+		{
+			m_this->m_frame.assign(buffer, buffer + size);
+			Color::Convert(buffer, size);
+			if (clusters)
+				Grapheme::ToBase(buffer, size);
+		}
+		tb_render();
+		if (convert || clusters)
+			std::copy(m_this->m_frame.cbegin(), m_this->m_frame.cend(), buffer);
+	}
+
+	// Clusters that are neither held nor drawn anymore are freed
+	Grapheme::Mark(tb_cell_buffer(), std::size_t(s_dim[0]) * s_dim[1]);
+	CellSurface::MarkClusters();
+	Grapheme::Collect();
 	++m_this->m_ctx.frameCount;
 }
 
+void Termbox::SetNativeOutput(bool native)
+{
+	if (native == static_cast<bool>(m_this->m_output))
+		return;
+
+	if (native)
+	{
+		m_this->m_output = std::make_unique<Output>();
+		m_this->m_output->SetSynchronized(m_this->m_ctx.synchronized);
+	}
+	else
+	{
+		m_this->m_output.reset();
+		// termbox does not know what the terminal displays anymore
+		tb_clear_screen();
+	}
+}
+
+bool Termbox::IsNativeOutput()
+{
+	return static_cast<bool>(m_this->m_output);
+}
+
+Output* Termbox::GetOutput()
+{
+	return m_this->m_output.get();
+}
+
+void Termbox::Scroll(Vec2i pos, Vec2i size, int lines)
+{
+	// Widgets may be drawn concurrently
+	#pragma omp critical(termbox_output)
+	if (m_this->m_output)
+		m_this->m_output->Scroll(pos, size, lines);
+}
+
 void Termbox::SetColor(Color bg)
 {
 	m_bg = bg;
@@ -102,7 +337,7 @@ Vec2i Termbox::GetDim()
 struct tb_cell Termbox::At(Vec2i pos)
 {
 	const auto& [x, y] = pos;
-	if (x * y >= s_dim[0] * s_dim[1])
+	if (x < 0 || y < 0 || x >= s_dim[0] || y >= s_dim[1])
 		return { 0, 0, 0 };
 
 	return tb_cell_buffer()[x + y * s_dim[0]];
@@ -110,7 +345,13 @@ struct tb_cell Termbox::At(Vec2i pos)
 
 void Termbox::SetCursor(Vec2i pos)
 {
-	tb_set_cursor(pos[0], pos[1]);
+	// Widgets may be drawn concurrently
+	#pragma omp critical(termbox_output)
+	{
+		tb_set_cursor(pos[0], pos[1]);
+		if (m_this->m_output)
+			m_this->m_output->SetCursor(pos);
+	}
 }
 
 std::size_t Termbox::AddWidget(Widget* widget)
@@ -164,17 +405,75 @@ bool Termbox::SetWidgetExpired(std::size_t id, bool expired)
 	return true;
 }
 
+static bool overlap(const std::pair<Vec2i, Vec2i>& a, const std::pair<Vec2i, Vec2i>& b)
+{
+	return a.first[0] < b.first[0] + b.second[0] && b.first[0] < a.first[0] + a.second[0] &&
+		a.first[1] < b.first[1] + b.second[1] && b.first[1] < a.first[1] + a.second[1];
+}
+
+void Termbox::SetParallelDraw(bool parallel)
+{
+	m_this->m_parallel = parallel;
+}
+
 void Termbox::ReDraw()
 {
 	if (m_this->m_ctx.clear)
 		Clear();
 
+	if (m_this->m_parallel)
+	{
+		std::vector<std::pair<Widget*, bool>> widgets;
+		bool disjoint = true;
+		for (const auto& it : m_this->m_widgets)
+		{
+			if (!it.first->IsVisible())
+				continue;
+			// Widgets saving what is under them are drawn after the ones under them, even when they have not changed
+			if (it.first->IsSaveUnder())
+				disjoint = false;
+			if (it.second || m_this->m_ctx.clear)
+				widgets.push_back(it);
+		}
+
+		for (std::size_t i = 0; i < widgets.size() && disjoint; ++i)
+		{
+			// Bounds include the column left of each widget: BorderItem reads and replaces the wide character there
+			for (std::size_t j = 0; j < i && disjoint; ++j)
+				disjoint = !overlap(widgets[i].first->GetBounds(), widgets[j].first->GetBounds());
+		}
+
+		if (disjoint && widgets.size() > 1)
+		{
+			// The widgets write to disjoint cells, the result does not depend on the order
+			#pragma omp parallel for schedule(dynamic)
+			for (std::size_t i = 0; i < widgets.size(); ++i)
+			{
+				const auto [pos, size] = widgets[i].first->GetBounds();
+				Draw::PushClip(pos, size);
+				widgets[i].first->Render(widgets[i].second);
+				Draw::PopClip();
+			}
+
+			for (auto& it : m_this->m_widgets)
+				it.second = false;
+			m_this->m_ctx.clear = false;
+			return;
+		}
+	}
+
+	// Whether widgets that may be under the next ones were drawn
+	bool drawn = false;
 	for (auto& it : m_this->m_widgets)
 	{
-		if (it.second || m_this->m_ctx.clear)
+		const bool under = drawn && it.first->IsSaveUnder() && it.first->IsVisible() && it.first->UpdateSaveUnder();
+		if (it.second || under || m_this->m_ctx.clear)
 		{
 			if (it.first->IsVisible())
-				m_this->Draw(*it.first);
+			{
+				it.first->Render(it.second);
+				drawn = true;
+			}
 			it.second = false;
 		}
 	}
@@ -250,6 +549,30 @@ void Termbox::RenderLoop()
 	static std::condition_variable cv;
 	static std::unique_lock<std::mutex> l(mtx);
 
+	// Keys typed while the terminal was queried that could not be given
+	// back to termbox, only text and control keys are recovered
+	String typeahead;
+	{
+		ANSI::Parser parser(TBStyle{});
+		std::vector<ANSI::Span> spans;
+		parser.Feed(std::exchange(m_this->m_typeahead, std::string()), typeahead, spans);
+		parser.Finish(typeahead, spans);
+	}
+	for (const Char c : typeahead)
+	{
+		tb_event& ev = m_this->m_ctx.ev;
+		ev = tb_event{};
+		ev.type = TB_EVENT_KEY;
+		// termbox reports control characters and space as keys, with their code
+		if (c <= U' ' || c == 0x7F)
+			ev.key = static_cast<std::uint16_t>(c);
+		else
+			ev.ch = c;
+		ProcessEvent();
+		if (m_this->m_ctx.stop)
+			return;
+	}
+
 	Clear();
 	ReDraw();
 	Display();
@@ -279,7 +602,10 @@ void Termbox::ForceDraw()
 	for (auto& it : m_this->m_widgets)
 	{
 		if (it.first->IsVisible())
-			m_this->Draw(*it.first);
+		{
+			it.first->UpdateSaveUnder();
+			it.first->Render(true);
+		}
 	}
 
 	if (m_this->m_ctx.clear)
@@ -5,9 +5,11 @@
 #include "Timed.hpp"
 #include "Listener.hpp"
 #include <deque>
+#include <memory>
 class Widget;
 class Window;
 class Termbox;
+class Output;
 
 
 ////////////////////////////////////////////////
@@ -41,11 +43,17 @@ class Termbox
 	static inline std::function<bool(void)> s_predicate;
 
 	std::vector<std::pair<Widget*, bool>> m_widgets;
+	std::vector<struct tb_cell> m_frame; ///< Unconverted copy of the frame being displayed
+	std::unique_ptr<Output> m_output; ///< Native output, nullptr to use termbox's
+	int m_tty; ///< Used to query the terminal, -1 if it could not be opened
+	std::string m_typeahead; ///< Input read while the terminal was queried that termbox could not be given back, replayed by RenderLoop
+	bool m_parallel; ///< Draw widgets concurrently
 
 	struct Context
 	{
 		bool stop = false;
 		bool clear = false;
+		bool synchronized = false; // The terminal supports synchronized updates (DEC mode 2026)
 		std::size_t frameCount = 0;
 		std::size_t repeat = 0;
 		bool hasRepeat = false;
@@ -109,9 +117,52 @@ public:
 	static void Resize();
 	////////////////////////////////////////////////
 	/// \brief Display what has been drawn to the screen
+	///
+	/// Colors are converted to the current output mode
+	/// in a single pass over the frame. If the terminal supports it,
+	/// the frame is sent as a synchronized update
+	/// (see Settings::synchronized_output)
+	/// \see Color::Convert
 	////////////////////////////////////////////////
 	static void Display();
 
+	////////////////////////////////////////////////
+	/// \brief Write frames to the terminal without termbox
+	///
+	/// \param native True to use the native output, false to use tb_render()
+	/// \throws Util::Exception If the terminal could not be opened
+	/// \note The native output can write frames from its own thread,
+	///  see Output::SetThreaded
+	/// \see Output
+	////////////////////////////////////////////////
+	static void SetNativeOutput(bool native);
+	////////////////////////////////////////////////
+	/// \brief Returns wether or not the native output is used
+	///
+	/// \returns True if frames are written by the native output
+	////////////////////////////////////////////////
+	static bool IsNativeOutput();
+	////////////////////////////////////////////////
+	/// \brief Get the native output
+	///
+	/// \returns The native output (e.g for its statistics),
+	///  nullptr when using termbox's output
+	////////////////////////////////////////////////
+	static Output* GetOutput();
+
+	////////////////////////////////////////////////
+	/// \brief Declare that a region of the screen scrolled
+	///
+	/// Lets the output scroll the terminal instead of rewriting the region,
+	/// ignored when using termbox's output
+	/// \param pos The position of the region
+	/// \param size The size of the region
+	/// \param lines The number of lines the content moved up by,
+	///  negative if it moved down
+	/// \see Output::Scroll
+	////////////////////////////////////////////////
+	static void Scroll(Vec2i pos, Vec2i size, int lines);
+
 	////////////////////////////////////////////////
 	/// \brief Set the background's color
 	///
@@ -211,10 +262,23 @@ public:
 	////////////////////////////////////////////////
 	static bool SetWidgetExpired(std::size_t id, bool expired);
 
+	////////////////////////////////////////////////
+	/// \brief Draw widgets concurrently
+	///
+	/// When the widgets to redraw do not overlap, they are drawn by
+	/// different threads, each one clipped to its bounds (its size plus
+	/// one cell, for borders). Otherwise they are drawn in order.
+	/// \param parallel True to draw widgets concurrently
+	/// \warning Widgets' Draw() and their OnDraw listeners must not
+	///  modify shared state
+	////////////////////////////////////////////////
+	static void SetParallelDraw(bool parallel);
+
 	////////////////////////////////////////////////
 	/// \brief Redraw widgets to the screen
 	///
 	/// Will only redraw wigets from the widget list that have been modified
+	/// \see SetParallelDraw
 	////////////////////////////////////////////////
 	static void ReDraw();
 
@@ -1,5 +1,9 @@
 #include "Text.hpp"
+#include "Cells.hpp"
 #include <type_traits>
+#include <cmath>
+#include <limits>
+#include <atomic>
 
 void Color::SetColor(std::uint32_t color)
 {
@@ -13,40 +17,132 @@ std::uint32_t Color::GetColor(std::uint32_t color) const
 
 tb_color Color::operator()() const
 {
-	/*
-	if (m_color == TB_DEFAULT)
-		return m_color;
-	switch (s_mode)
+	return m_color;
+}
+
+// xterm's default ANSI colors, then their bright variants
+static constexpr std::uint8_t s_ansi[16][3] = {
+	{ 0, 0, 0 }, { 205, 0, 0 }, { 0, 205, 0 }, { 205, 205, 0 },
+	{ 0, 0, 238 }, { 205, 0, 205 }, { 0, 205, 205 }, { 229, 229, 229 },
+	{ 127, 127, 127 }, { 255, 0, 0 }, { 0, 255, 0 }, { 255, 255, 0 },
+	{ 92, 92, 255 }, { 255, 0, 255 }, { 0, 255, 255 }, { 255, 255, 255 }
+};
+// Levels of the 6x6x6 color cube
+static constexpr std::uint8_t s_levels[6] = { 0, 95, 135, 175, 215, 255 };
+
+Color Color::Palette(std::uint8_t index)
+{
+	std::uint32_t rgb;
+	if (index < 16)
+		rgb = s_ansi[index][0] << 16 | s_ansi[index][1] << 8 | s_ansi[index][2];
+	else if (index < 232)
+	{
+		const int i = index - 16;
+		rgb = s_levels[i / 36] << 16 | s_levels[i / 6 % 6] << 8 | s_levels[i % 6];
+	}
+	else
+	{
+		const std::uint32_t v = 8 + (index - 232) * 10;
+		rgb = v << 16 | v << 8 | v;
+	}
+	// 0 stands for the default color
+	return Color(rgb == (TB_DEFAULT & 0xFFFFFF) ? 1 : rgb);
+}
+
+// sRGB (D65) to CIELAB
+static std::array<float, 3> toLab(std::uint8_t r, std::uint8_t g, std::uint8_t b)
+{
+	const auto linear = [](std::uint8_t c)
+	{
+		const float v = c / 255.f;
+		return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+	};
+	const float lr = linear(r), lg = linear(g), lb = linear(b);
+
+	const float x = (0.4124f * lr + 0.3576f * lg + 0.1805f * lb) / 0.95047f;
+	const float y = (0.2126f * lr + 0.7152f * lg + 0.0722f * lb);
+	const float z = (0.0193f * lr + 0.1192f * lg + 0.9505f * lb) / 1.08883f;
+
+	const auto f = [](float t)
 	{
-		case Color::COLORS_8:
-			return (m_color >> 16 & 0x80) | (m_color >> 8 & 0x80) << 1 |
-				   (m_color & 0x80) << 2;
-		case Color::COLORS_16:
-			return (((m_color >> 16 & 0xFF) | (m_color >> 8 & 0xFF) | (m_color & 0xFF)) ?
-						0b1000 :
-						0b0000) |
-				   (m_color >> 16 & 0x80) | (m_color >> 8 & 0x80) << 1 |
-				   (m_color & 0x80) << 2;
-		case Color::COLORS_256: {
-			std::uint8_t shade = (m_color >> 4 & 0x18);
-			// Grayscale
-			if ((m_color >> 20 & 0x18) == shade && (m_color >> 12 & 0x18) == shade)
-				return 255 - shade;
-			// 6x6x6 RGB cube
-			return (m_color >> 21 & 0x06) * 36 + (m_color >> 13 & 0x06) * 6 +
-				   (m_color >> 5 & 0x06);
+		return t > 0.008856f ? std::cbrt(t) : 7.787f * t + 16.f / 116.f;
+	};
+	const float fx = f(x), fy = f(y), fz = f(z);
+
+	return { 116.f * fy - 16.f, 500.f * (fx - fy), 200.f * (fy - fz) };
+}
+
+void Color::BuildLUT(Color::COLOR_MODE mode)
+{
+	if (mode == COLORS_TRUECOLOR || mode == s_lutMode)
+		return;
+
+	// Palette as {output color, r, g, b}
+	std::vector<std::array<std::uint8_t, 4>> palette;
+	if (mode == COLORS_8)
+	{
+		for (std::uint8_t i = 0; i < 8; ++i)
+			palette.push_back({ static_cast<std::uint8_t>(TB_BLACK + i), s_ansi[i][0], s_ansi[i][1], s_ansi[i][2] });
+	}
+	else
+	{
+		// The first 16 colors are left out as they depend on the terminal's theme
+		for (std::uint8_t i = 0; i < 216; ++i)
+			palette.push_back({ static_cast<std::uint8_t>(16 + i), s_levels[i / 36], s_levels[i / 6 % 6], s_levels[i % 6] });
+		for (std::uint8_t i = 0; i < 24; ++i)
+		{
+			const std::uint8_t v = 8 + i * 10;
+			palette.push_back({ static_cast<std::uint8_t>(232 + i), v, v, v });
 		}
-		case Color::COLORS_TRUECOLOR:
-			return m_color;
 	}
-	*/
-	return m_color;
+
+	std::vector<std::array<float, 3>> paletteLab(palette.size());
+	for (std::size_t i = 0; i < palette.size(); ++i)
+		paletteLab[i] = toLab(palette[i][1], palette[i][2], palette[i][3]);
+
+	static constexpr int bins = 1 << s_lutBits;
+	static constexpr int shift = 8 - s_lutBits;
+	for (int i = 0; i < bins * bins * bins; ++i)
+	{
+		const auto center = [](int bin) -> std::uint8_t
+		{
+			return (bin << shift) | (1 << (shift - 1));
+		};
+		const auto lab = toLab(center(i >> (2 * s_lutBits)), center((i >> s_lutBits) & (bins - 1)), center(i & (bins - 1)));
+
+		std::size_t best = 0;
+		float bestDist = std::numeric_limits<float>::max();
+		for (std::size_t j = 0; j < palette.size(); ++j)
+		{
+			const float dl = lab[0] - paletteLab[j][0];
+			const float da = lab[1] - paletteLab[j][1];
+			const float db = lab[2] - paletteLab[j][2];
+			const float dist = dl * dl + da * da + db * db;
+			if (dist < bestDist)
+			{
+				bestDist = dist;
+				best = j;
+			}
+		}
+		s_lut[i] = palette[best][0];
+	}
+
+	s_lutMode = mode;
+}
+
+void Color::Convert(struct tb_cell* cells, std::size_t size)
+{
+	if (s_mode == COLORS_TRUECOLOR)
+		return;
+
+	Cells::Remap(cells, size, s_lut.data(), s_lutBits);
 }
 
 void Color::SetMode(Color::COLOR_MODE mode)
 {
 	s_mode = mode;
 	tb_select_output_mode(mode);
+	BuildLUT(mode);
 }
 
 const Color::COLOR_MODE& Color::GetMode()
@@ -56,8 +152,13 @@ const Color::COLOR_MODE& Color::GetMode()
 
 TBChar& TBChar::operator=(const TBChar& c)
 {
+	// c may be *this, or hold the last reference to ch
+	const Char old = ch;
 	ch = c.ch;
 	s = c.s;
+	acquire();
+	if (Grapheme::IsCluster(old))
+		Grapheme::Release(old);
 	return *this;
 }
 
@@ -71,59 +172,85 @@ struct tb_cell TBChar::operator()() const
 	return c;
 }
 
+// One TBChar per grapheme cluster
+static void append(std::vector<TBChar>& string, StringView str, const TBStyle& s)
+{
+	string.reserve(string.size() + str.size());
+	for (std::size_t i = 0; i < str.size();)
+	{
+		const std::size_t j = Grapheme::Next(str, i);
+		string.emplace_back(Grapheme::Intern(str.substr(i, j - i)), s);
+		i = j;
+	}
+}
+
+static void assign(std::vector<TBChar>& string, StringView str, const TBStyle& s)
+{
+	string.clear();
+	append(string, str, s);
+}
+
+static void append(std::vector<TBChar>& string, TBStringView s)
+{
+	// s may be a view over string itself, which resizing may move
+	if (s.Size() && s.Data() >= string.data() && s.Data() < string.data() + string.size())
+	{
+		std::vector<TBChar> copy(s.Size());
+		for (std::size_t i = 0; i < s.Size(); ++i)
+			copy[i] = s[i];
+		return append(string, TBStringView(copy.data(), copy.size()));
+	}
+
+	const std::size_t pos = string.size();
+	string.resize(pos + s.Size());
+	for (std::size_t i = 0; i < s.Size(); ++i)
+		string[pos + i] = s[i];
+}
+
 TBString::TBString()
 {
 }
 
-TBString::TBString(const TBChar* a, std::size_t size)
+TBString::TBString(const TBChar* a, std::size_t size):
+	m_string(std::make_shared<std::vector<TBChar>>(a, a + size))
 {
-	m_string = std::vector<TBChar>(size, TBChar());
-	for (std::size_t i = 0; i < size; ++i)
-		m_string[i] = a[i];
 }
 
-TBString::TBString(const Char* str, TBStyle s)
+TBString::TBString(const Char* str, TBStyle s):
+	m_string(std::make_shared<std::vector<TBChar>>())
 {
-	std::size_t size = Util::Strlen(str);
-	m_string = std::vector<TBChar>(size, TBChar(0, s));
-	for (std::size_t i = 0; i < size; ++i)
-		m_string[i].ch = str[i];
+	assign(*m_string, StringView(str, Util::Strlen(str)), s);
 }
 
-TBString::TBString(TBChar c, std::size_t size)
+TBString::TBString(TBChar c, std::size_t size):
+	m_string(std::make_shared<std::vector<TBChar>>(size, c))
 {
-	m_string = std::vector<TBChar>(size, c);
 }
 
-TBString::TBString(const String& str, TBStyle s)
+TBString::TBString(const String& str, TBStyle s):
+	m_string(std::make_shared<std::vector<TBChar>>())
 {
-	std::size_t size = str.size();
-	m_string = std::vector<TBChar>(size, TBChar(0, s));
-	for (std::size_t i = 0; i < size; ++i)
-		m_string[i].ch = str[i];
+	assign(*m_string, str, s);
 }
 
-TBString::TBString(const StringView& str, TBStyle s)
+TBString::TBString(const StringView& str, TBStyle s):
+	m_string(std::make_shared<std::vector<TBChar>>())
 {
-	std::size_t size = str.size();
-	m_string = std::vector<TBChar>(size, TBChar(0, s));
-	for (std::size_t i = 0; i < size; ++i)
-		m_string[i].ch = str[i];
+	assign(*m_string, str, s);
 }
 
-TBString::TBString(const TBString& s)
+TBString::TBString(const TBString& s):
+	m_string(s.m_string)
 {
-	m_string = s.m_string;
 }
 
-TBString::TBString(TBString&& s)
+TBString::TBString(TBString&& s) noexcept:
+	m_string(std::move(s.m_string))
 {
-	m_string = std::move(s.m_string);
 }
 
 TBString::~TBString()
 {
-	m_string.clear();
 }
 
 TBString& TBString::operator=(const TBString& s)
@@ -132,52 +259,147 @@ TBString& TBString::operator=(const TBString& s)
 	return *this;
 }
 
+TBString& TBString::operator=(TBString&& s) noexcept
+{
+	m_string = std::move(s.m_string);
+	return *this;
+}
+
+std::vector<TBChar>& TBString::Mutable()
+{
+	if (!m_string)
+		m_string = std::make_shared<std::vector<TBChar>>();
+	else if (m_string.use_count() > 1)
+		m_string = std::make_shared<std::vector<TBChar>>(*m_string);
+	else
+		// use_count() is a relaxed load: the fence orders the writes that follow after the
+		// reads of a thread that just released the last other copy (its decrement is a release)
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+	return *m_string;
+}
+
 const TBChar& TBString::operator[](std::size_t i) const
 {
-	return m_string[i];
+	return Chars()[i];
 }
 
 TBChar& TBString::operator[](std::size_t i)
 {
-	return m_string[i];
+	return Mutable()[i];
 }
 
-TBString& TBString::operator+(const TBString& tbs)
+TBString TBString::operator+(TBStringView tbs) const
 {
-	const std::size_t pos = Size();
-	m_string.resize(pos+tbs.Size());
-
-	for (std::size_t i = 0; i < tbs.Size(); ++i)
-		m_string[pos+i] = tbs[i];
+	TBString r;
+	auto& string = r.Mutable();
+	string.reserve(Size() + tbs.Size());
+	append(string, *this);
+	append(string, tbs);
+	return r;
+}
 
+TBString& TBString::operator+=(TBStringView tbs)
+{
+	append(Mutable(), tbs);
 	return *this;
 }
 
 std::size_t TBString::Size() const
 {
-	return m_string.size();
+	return Chars().size();
 }
 
 int TBString::SizeWide() const
 {
 	int width = 0;
-	for (const auto& c : m_string)
-		width += wcwidth(c.ch);
+	for (const auto& c : Chars())
+		width += Grapheme::Width(c.ch);
 
 	return width;
 }
 
 void TBString::Clear()
 {
-	m_string.clear();
+	m_string.reset();
 }
 
 String TBString::Str() const
 {
-	String r(Size(), U' ');
+	String r;
+	r.reserve(Size());
+
+	for (const auto& c : Chars())
+		r.append(Grapheme::Get(c.ch));
+
+	return r;
+}
+
+int TBStringView::SizeWide() const
+{
+	int width = 0;
+	for (std::size_t i = 0; i < m_size; ++i)
+		width += Grapheme::Width(m_data[i].ch);
+
+	return width;
+}
+
+TBStringBuilder::TBStringBuilder()
+{
+}
+
+TBStringBuilder::TBStringBuilder(std::size_t capacity)
+{
+	m_string.reserve(capacity);
+}
+
+void TBStringBuilder::Reserve(std::size_t capacity)
+{
+	m_string.reserve(capacity);
+}
+
+TBStringBuilder& TBStringBuilder::Append(TBStringView s)
+{
+	append(m_string, s);
+	return *this;
+}
+
+TBStringBuilder& TBStringBuilder::Append(StringView s, const TBStyle& style)
+{
+	append(m_string, s, style);
+	return *this;
+}
+
+TBStringBuilder& TBStringBuilder::Append(const TBChar& c)
+{
+	m_string.push_back(c);
+	return *this;
+}
+
+TBStringBuilder& TBStringBuilder::operator+=(TBStringView s)
+{
+	return Append(s);
+}
+
+void TBStringBuilder::Clear()
+{
+	m_string.clear();
+}
+
+std::size_t TBStringBuilder::Size() const
+{
+	return m_string.size();
+}
 
-	for (std::size_t i = 0; i < Size(); ++i)
-		r[i] = m_string[i].ch;
+TBStringView TBStringBuilder::View() const
+{
+	return TBStringView(m_string.data(), m_string.size());
+}
 
+TBString TBStringBuilder::Build()
+{
+	TBString r;
+	r.m_string = std::make_shared<std::vector<TBChar>>(std::move(m_string));
+	m_string.clear();
 	return r;
 }
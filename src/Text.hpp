@@ -2,7 +2,13 @@
 #define TERMBOXWIDGETS_TEXT_HPP
 
 #include "Util.hpp"
+#include "Grapheme.hpp"
 #include "termbox/src/termbox.h"
+#include <span>
+#include <optional>
+#include <memory>
+#include <utility>
+#include <type_traits>
 
 /** @cond */
 MAKE_CENUM_Q(TextStyle, int,
@@ -41,6 +47,22 @@ public:
 private:
 	inline static COLOR_MODE s_mode = COLORS_8;
 
+	////////////////////////////////////////////////
+	/// \brief Number of bits kept per channel to index the lookup table
+	////////////////////////////////////////////////
+	static constexpr int s_lutBits = 5;
+	inline static std::array<std::uint8_t, 1 << (3 * s_lutBits)> s_lut;
+	inline static COLOR_MODE s_lutMode = COLORS_TRUECOLOR;
+
+	////////////////////////////////////////////////
+	/// \brief Build the RGB lookup table for mode
+	///
+	/// Every entry of the table holds the palette color
+	/// that is perceptually the closest (in CIELAB space)
+	/// to the center of its RGB bin.
+	////////////////////////////////////////////////
+	static void BuildLUT(COLOR_MODE mode);
+
 	std::uint32_t m_color;
 
 public:
@@ -79,16 +101,38 @@ public:
 
 
 	////////////////////////////////////////////////
-	/// \brief Get the color in the current mode
+	/// \brief Get the color for the cell buffer
 	///
-	/// \returns a termbox-compatible color for the
-	///  current display mode
+	/// \returns a termbox-compatible color in 24 bit RGB
+	/// \note Colors are only converted to the current
+	///  output mode when the frame is displayed
+	/// \see Convert
 	////////////////////////////////////////////////
 	tb_color operator()() const;
 
+	////////////////////////////////////////////////
+	/// \brief Get a color of the 256 color palette
+	///
+	/// \param index The index in the palette
+	/// \returns The color in 24 bit RGB, as in xterm's default palette
+	/// \note Black is 0x000001, since 0 stands for the default color
+	////////////////////////////////////////////////
+	static Color Palette(std::uint8_t index);
+
+	////////////////////////////////////////////////
+	/// \brief Convert cells to the current output mode
+	///
+	/// \param cells The cells (in 24 bit RGB) to convert
+	/// \param size The number of cells
+	/// \note Does nothing in COLORS_TRUECOLOR mode
+	////////////////////////////////////////////////
+	static void Convert(struct tb_cell* cells, std::size_t size);
+
 
 	////////////////////////////////////////////////
 	/// \brief Mode used for outputting
+	///
+	/// Will (re)build the conversion table if needed
 	////////////////////////////////////////////////
 	static void SetMode(COLOR_MODE mode);
 
@@ -162,9 +206,24 @@ struct TBStyle
 ////////////////////////////////////////////////
 struct TBChar
 {
-	Char ch;
+	Char ch; ///< A codepoint or a cluster, see Grapheme. Clusters are counted: assign whole TBChar
 	TBStyle s;
 
+private:
+	// Clusters are held by the TBChar that store them, see Grapheme::Acquire
+	constexpr void acquire()
+	{
+		if (!std::is_constant_evaluated() && Grapheme::IsCluster(ch))
+			Grapheme::Acquire(ch);
+	}
+
+	constexpr void release()
+	{
+		if (!std::is_constant_evaluated() && Grapheme::IsCluster(ch))
+			Grapheme::Release(ch);
+	}
+
+public:
 	////////////////////////////////////////////////
 	/// \brief Default constructor
 	////////////////////////////////////////////////
@@ -181,6 +240,7 @@ struct TBChar
 	{
 		ch = c.ch;
 		s = c.s;
+		acquire();
 	}
 
 	////////////////////////////////////////////////
@@ -188,7 +248,7 @@ struct TBChar
 	////////////////////////////////////////////////
 	constexpr TBChar(TBChar&& c)
 	{
-		ch = std::move(c.ch);
+		ch = std::exchange(c.ch, 0);
 		s = std::move(c.s);
 	}
 
@@ -205,6 +265,7 @@ struct TBChar
 	{
 		this->ch = ch;
 		this->s = TBStyle(fg, bg, s);
+		acquire();
 	}
 
 	////////////////////////////////////////////////
@@ -218,6 +279,15 @@ struct TBChar
 	{
 		this->ch = ch;
 		this->s = s;
+		acquire();
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Destructor
+	////////////////////////////////////////////////
+	constexpr ~TBChar()
+	{
+		release();
 	}
 
 	////////////////////////////////////////////////
@@ -234,13 +304,45 @@ struct TBChar
 };
 
 
+class TBStringView;
+class TBStringBuilder;
+
 ////////////////////////////////////////////////
 /// \brief Class that holds a string of TBChar
+///
+/// Strings are split into grapheme clusters when constructed,
+/// each TBChar holds a whole cluster (see Grapheme)
+///
+/// Copies share the same characters, through an atomic reference count:
+/// copying a string only copies a pointer. The characters are copied when
+/// a string that shares them is modified (copy on write).
+/// Strings sharing their characters may be copied, read, modified and
+/// destroyed from different threads. As with any object, a single TBString
+/// must not be modified while another thread uses it.
+/// \warn References and iterators obtained through non const accessors
+///  must not be kept once the string is copied
 /// \see TBChar
 ////////////////////////////////////////////////
 class TBString
 {
-	std::vector<TBChar> m_string;
+	friend class TBStringBuilder;
+	std::shared_ptr<std::vector<TBChar>> m_string; ///< Shared by copies, nullptr if empty
+	inline static const std::vector<TBChar> s_empty;
+
+	////////////////////////////////////////////////
+	/// \brief Get the characters, for reading
+	////////////////////////////////////////////////
+	const std::vector<TBChar>& Chars() const
+	{
+		return m_string ? *m_string : s_empty;
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Get the characters, for writing
+	///
+	/// Copies them first if they are shared
+	////////////////////////////////////////////////
+	std::vector<TBChar>& Mutable();
 
 public:
 	////////////////////////////////////////////////
@@ -289,7 +391,7 @@ public:
 	////////////////////////////////////////////////
 	/// \brief Move constructor
 	////////////////////////////////////////////////
-	TBString(TBString&& s);
+	TBString(TBString&& s) noexcept;
 
 	////////////////////////////////////////////////
 	/// \brief Destructor
@@ -301,6 +403,11 @@ public:
 	////////////////////////////////////////////////
 	TBString& operator=(const TBString& s);
 
+	////////////////////////////////////////////////
+	/// \brief Move assign operator
+	////////////////////////////////////////////////
+	TBString& operator=(TBString&& s) noexcept;
+
 	////////////////////////////////////////////////
 	/// \brief Const subscript operator
 	/// \param i The index
@@ -322,48 +429,86 @@ public:
 	/// \brief Concatenation
 	/// \param tbs The TBString to append
 	///
+	/// \returns A new TBString, made of this string followed by tbs
+	////////////////////////////////////////////////
+	TBString operator+(TBStringView tbs) const;
+
+	////////////////////////////////////////////////
+	/// \brief Append
+	/// \param tbs The TBString to append
+	///
 	/// \returns A reference to the TBString with tbs appended
 	////////////////////////////////////////////////
-	TBString& operator+(const TBString& tbs);
+	TBString& operator+=(TBStringView tbs);
 
 	auto cbegin() const
 	{
-		return m_string.cbegin();
+		return Chars().cbegin();
+	}
+
+	auto begin() const
+	{
+		return Chars().cbegin();
 	}
 
 	auto begin()
 	{
-		return m_string.begin();
+		return Mutable().begin();
 	}
 
 	auto cend() const
 	{
-		return m_string.cend();
+		return Chars().cend();
+	}
+
+	auto end() const
+	{
+		return Chars().cend();
 	}
 
 	auto end()
 	{
-		return m_string.end();
+		return Mutable().end();
 	}
 
 	auto crbegin() const
 	{
-		return m_string.crbegin();
+		return Chars().crbegin();
+	}
+
+	auto rbegin() const
+	{
+		return Chars().crbegin();
 	}
 
 	auto rbegin()
 	{
-		return m_string.rbegin();
+		return Mutable().rbegin();
 	}
 
 	auto crend() const
 	{
-		return m_string.crend();
+		return Chars().crend();
+	}
+
+	auto rend() const
+	{
+		return Chars().crend();
 	}
 
 	auto rend()
 	{
-		return m_string.rend();
+		return Mutable().rend();
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Characters of the string
+	///
+	/// \returns A pointer to the first character
+	////////////////////////////////////////////////
+	const TBChar* Data() const
+	{
+		return Chars().data();
 	}
 
 	////////////////////////////////////////////////
@@ -388,9 +533,249 @@ public:
 	////////////////////////////////////////////////
 	/// \brief String content
 	///
-	/// \returns The string's content
+	/// \returns The string's content, clusters are expanded to their codepoints
 	////////////////////////////////////////////////
 	String Str() const;
 };
 
+////////////////////////////////////////////////
+/// \brief Non owning view over TBChars
+///
+/// The style of every character may be replaced by a single style,
+/// without copying the characters:
+/// \code{.cpp}
+/// // Draw the 5 characters after the 10th one, highlighted
+/// Draw::TextLine(TBStringView(s).Substr(10, 5).WithStyle(highlight), pos, w, trailing);
+/// \endcode
+/// \warn The characters must outlive the view
+////////////////////////////////////////////////
+class TBStringView
+{
+	const TBChar* m_data;
+	std::size_t m_size;
+	std::optional<TBStyle> m_style; ///< Replaces the style of every character
+
+public:
+	////////////////////////////////////////////////
+	/// \brief Default constructor, an empty view
+	////////////////////////////////////////////////
+	constexpr TBStringView():
+		m_data(nullptr), m_size(0)
+	{
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Constructor
+	///
+	/// \param data The characters
+	/// \param size The number of characters
+	////////////////////////////////////////////////
+	constexpr TBStringView(const TBChar* data, std::size_t size):
+		m_data(data), m_size(size)
+	{
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Span constructor
+	///
+	/// \param s The characters
+	////////////////////////////////////////////////
+	constexpr TBStringView(std::span<const TBChar> s):
+		m_data(s.data()), m_size(s.size())
+	{
+	}
+
+	////////////////////////////////////////////////
+	/// \brief TBString constructor
+	///
+	/// \param s The string
+	////////////////////////////////////////////////
+	TBStringView(const TBString& s):
+		m_data(s.Data()), m_size(s.Size())
+	{
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Get the number of characters
+	////////////////////////////////////////////////
+	constexpr std::size_t Size() const
+	{
+		return m_size;
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Get the characters
+	///
+	/// \returns A pointer to the first character, their style may be replaced
+	////////////////////////////////////////////////
+	constexpr const TBChar* Data() const
+	{
+		return m_data;
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Get a character
+	/// \param i The index
+	///
+	/// \returns The character at position i
+	/// \warn Performs no bound checking.
+	////////////////////////////////////////////////
+	constexpr Char Ch(std::size_t i) const
+	{
+		return m_data[i].ch;
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Get the style of a character
+	/// \param i The index
+	///
+	/// \returns The style of the character at position i
+	/// \warn Performs no bound checking.
+	////////////////////////////////////////////////
+	constexpr const TBStyle& Style(std::size_t i) const
+	{
+		return m_style ? *m_style : m_data[i].s;
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Subscript operator
+	/// \param i The index
+	///
+	/// \returns The character at position i, with its style
+	/// \warn Performs no bound checking.
+	////////////////////////////////////////////////
+	constexpr TBChar operator[](std::size_t i) const
+	{
+		return TBChar(Ch(i), Style(i));
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Get a part of the view
+	///
+	/// \param pos The index of the first character
+	/// \param count The maximum number of characters
+	/// \returns A view over [pos, pos+count), clamped to the view
+	////////////////////////////////////////////////
+	constexpr TBStringView Substr(std::size_t pos, std::size_t count = static_cast<std::size_t>(-1)) const
+	{
+		TBStringView v(*this);
+		v.m_data += std::min(pos, m_size);
+		v.m_size = std::min(count, m_size - std::min(pos, m_size));
+		return v;
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Replace the style of every character
+	///
+	/// \param style The style
+	/// \returns A view over the same characters, with style
+	////////////////////////////////////////////////
+	constexpr TBStringView WithStyle(const TBStyle& style) const
+	{
+		TBStringView v(*this);
+		v.m_style = style;
+		return v;
+	}
+
+	////////////////////////////////////////////////
+	/// \brief Size of the view (in cell)
+	///
+	/// \returns The size of the view in cell
+	////////////////////////////////////////////////
+	int SizeWide() const;
+};
+
+////////////////////////////////////////////////
+/// \brief Builds a TBString by appending to it
+///
+/// The builder can be reused once cleared, without
+/// allocating again:
+/// \code{.cpp}
+/// label.Clear();
+/// label.Append(name).Append(U": ", style).Append(value);
+/// Draw::TextLine(label.View(), pos, w, trailing);
+/// \endcode
+////////////////////////////////////////////////
+class TBStringBuilder
+{
+	std::vector<TBChar> m_string;
+
+public:
+	////////////////////////////////////////////////
+	/// \brief Default constructor
+	////////////////////////////////////////////////
+	TBStringBuilder();
+
+	////////////////////////////////////////////////
+	/// \brief Constructor
+	///
+	/// \param capacity The number of characters to reserve
+	////////////////////////////////////////////////
+	explicit TBStringBuilder(std::size_t capacity);
+
+	////////////////////////////////////////////////
+	/// \brief Reserve room for characters
+	///
+	/// \param capacity The total number of characters to reserve
+	////////////////////////////////////////////////
+	void Reserve(std::size_t capacity);
+
+	////////////////////////////////////////////////
+	/// \brief Append characters
+	///
+	/// \param s The characters to append
+	/// \returns A reference to the builder
+	////////////////////////////////////////////////
+	TBStringBuilder& Append(TBStringView s);
+
+	////////////////////////////////////////////////
+	/// \brief Append a string
+	///
+	/// \param s The string to append, split into grapheme clusters
+	/// \param style The style of the string
+	/// \returns A reference to the builder
+	////////////////////////////////////////////////
+	TBStringBuilder& Append(StringView s, const TBStyle& style);
+
+	////////////////////////////////////////////////
+	/// \brief Append a character
+	///
+	/// \param c The character to append
+	/// \returns A reference to the builder
+	////////////////////////////////////////////////
+	TBStringBuilder& Append(const TBChar& c);
+
+	////////////////////////////////////////////////
+	/// \brief Append characters
+	///
+	/// \param s The characters to append
+	/// \returns A reference to the builder
+	////////////////////////////////////////////////
+	TBStringBuilder& operator+=(TBStringView s);
+
+	////////////////////////////////////////////////
+	/// \brief Remove every character, keeping the reserved room
+	////////////////////////////////////////////////
+	void Clear();
+
+	////////////////////////////////////////////////
+	/// \brief Get the number of characters
+	////////////////////////////////////////////////
+	std::size_t Size() const;
+
+	////////////////////////////////////////////////
+	/// \brief Get a view over the characters
+	///
+	/// \returns A view, invalidated when the builder is modified
+	////////////////////////////////////////////////
+	TBStringView View() const;
+
+	////////////////////////////////////////////////
+	/// \brief Get the built string
+	///
+	/// \returns The string, the builder is left empty
+	////////////////////////////////////////////////
+	TBString Build();
+};
+
 #endif // TERMBOXWIDGETS_TEXT_HPP
@@ -0,0 +1,429 @@
+#include "UTF8.hpp"
+#include <cstring>
+#include <charconv>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+using DecodeASCIIFn = std::size_t (*)(const unsigned char* in, std::size_t size, Char* out);
+using EncodeASCIIFn = std::size_t (*)(const Char* in, std::size_t size, unsigned char* out);
+
+// The ASCII kernels convert the longest run of ASCII they can, in blocks,
+// and return its size. What is left of the run is smaller than a block.
+
+#ifdef __SSE2__
+static std::size_t decodeASCIISSE2(const unsigned char* in, std::size_t size, Char* out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	std::size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		if (_mm_movemask_epi8(v))
+			break;
+		const __m128i lo = _mm_unpacklo_epi8(v, zero);
+		const __m128i hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+	}
+	return i;
+}
+
+static std::size_t encodeASCIISSE2(const Char* in, std::size_t size, unsigned char* out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i high = _mm_set1_epi32(~0x7F);
+	std::size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 4));
+		const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+		const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+		const __m128i any = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), high);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(any, zero)) != 0xFFFF)
+			break;
+		// Values are below 0x80, saturation does not change them
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static std::size_t decodeASCIIAVX2(const unsigned char* in, std::size_t size, Char* out)
+{
+	std::size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		if (_mm256_movemask_epi8(v))
+			break;
+		for (std::size_t k = 0; k < 32; k += 8)
+		{
+			const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i + k));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + k), _mm256_cvtepu8_epi32(bytes));
+		}
+	}
+	// The SSE2 kernel is not VEX encoded, leaving the upper halves dirty would stall it
+	_mm256_zeroupper();
+	return i + decodeASCIISSE2(in + i, size - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static std::size_t encodeASCIIAVX2(const Char* in, std::size_t size, unsigned char* out)
+{
+	const __m256i high = _mm256_set1_epi32(~0x7F);
+	// Packing works within 128 bit lanes, this puts the dwords back in order
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	std::size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+	{
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 8));
+		const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 16));
+		const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 24));
+		const __m256i any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+		if (!_mm256_testz_si256(any, high))
+			break;
+		const __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permutevar8x32_epi32(packed, order));
+	}
+	// The SSE2 kernel is not VEX encoded, leaving the upper halves dirty would stall it
+	_mm256_zeroupper();
+	return i + encodeASCIISSE2(in + i, size - i, out + i);
+}
+#else
+static std::size_t decodeASCIIScalar(const unsigned char* in, std::size_t size, Char* out)
+{
+	std::size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		std::uint64_t v;
+		std::memcpy(&v, in + i, 8);
+		if (v & 0x8080808080808080ull)
+			break;
+		for (std::size_t k = 0; k < 8; ++k)
+			out[i + k] = in[i + k];
+	}
+	return i;
+}
+
+static std::size_t encodeASCIIScalar(const Char* in, std::size_t size, unsigned char* out)
+{
+	std::size_t i = 0;
+	for (; i + 4 <= size; i += 4)
+	{
+		if ((in[i] | in[i + 1] | in[i + 2] | in[i + 3]) >= 0x80)
+			break;
+		for (std::size_t k = 0; k < 4; ++k)
+			out[i + k] = static_cast<unsigned char>(in[i + k]);
+	}
+	return i;
+}
+#endif
+
+// The kernels are chosen once, for the running CPU
+static DecodeASCIIFn decodeASCII()
+{
+	static const DecodeASCIIFn fn = []() -> DecodeASCIIFn
+	{
+#ifdef __SSE2__
+		if (__builtin_cpu_supports("avx2"))
+			return decodeASCIIAVX2;
+		return decodeASCIISSE2;
+#else
+		return decodeASCIIScalar;
+#endif
+	}();
+	return fn;
+}
+
+static EncodeASCIIFn encodeASCII()
+{
+	static const EncodeASCIIFn fn = []() -> EncodeASCIIFn
+	{
+#ifdef __SSE2__
+		if (__builtin_cpu_supports("avx2"))
+			return encodeASCIIAVX2;
+		return encodeASCIISSE2;
+#else
+		return encodeASCIIScalar;
+#endif
+	}();
+	return fn;
+}
+
+enum class Status
+{
+	Valid,
+	Invalid,
+	Incomplete,
+};
+
+// Decodes the sequence starting at in[0]. size receives the length of the
+// sequence, or of its maximal valid part when it is invalid or incomplete.
+static Status decodeSequence(const unsigned char* in, std::size_t available, Char& c, std::size_t& size)
+{
+	const unsigned char lead = in[0];
+	std::size_t length;
+	Char cp;
+	// Range of the second byte, that excludes overlong forms, surrogates and values past U+10FFFF
+	unsigned char lo = 0x80, hi = 0xBF;
+	if (lead < 0x80)
+	{
+		c = lead;
+		size = 1;
+		return Status::Valid;
+	}
+	else if (lead >= 0xC2 && lead <= 0xDF)
+	{
+		length = 2;
+		cp = lead & 0x1F;
+	}
+	else if (lead >= 0xE0 && lead <= 0xEF)
+	{
+		length = 3;
+		cp = lead & 0x0F;
+		if (lead == 0xE0)
+			lo = 0xA0;
+		else if (lead == 0xED)
+			hi = 0x9F;
+	}
+	else if (lead >= 0xF0 && lead <= 0xF4)
+	{
+		length = 4;
+		cp = lead & 0x07;
+		if (lead == 0xF0)
+			lo = 0x90;
+		else if (lead == 0xF4)
+			hi = 0x8F;
+	}
+	else
+	{
+		size = 1;
+		return Status::Invalid;
+	}
+
+	for (std::size_t i = 1; i < length; ++i)
+	{
+		if (i >= available)
+		{
+			size = i;
+			return Status::Incomplete;
+		}
+		if (in[i] < lo || in[i] > hi)
+		{
+			size = i;
+			return Status::Invalid;
+		}
+		lo = 0x80;
+		hi = 0xBF;
+		cp = (cp << 6) | (in[i] & 0x3F);
+	}
+	c = cp;
+	size = length;
+	return Status::Valid;
+}
+
+static void invalidInput(std::size_t offset)
+{
+	throw Util::Exception("Invalid UTF-8 at byte " + std::to_string(offset));
+}
+
+// Converts in, up to an incomplete sequence at its end unless final
+static std::size_t decode(const unsigned char* in, std::size_t size, Char* out, UTF8::Mode mode, bool final, std::size_t& consumed, std::size_t offset)
+{
+	const DecodeASCIIFn ascii = decodeASCII();
+	std::size_t i = 0;
+	std::size_t o = 0;
+	while (i < size)
+	{
+		if (in[i] < 0x80)
+		{
+			const std::size_t run = ascii(in + i, size - i, out + o);
+			i += run;
+			o += run;
+			while (i < size && in[i] < 0x80)
+				out[o++] = in[i++];
+			continue;
+		}
+
+		Char c;
+		std::size_t length;
+		switch (decodeSequence(in + i, size - i, c, length))
+		{
+			case Status::Valid:
+				out[o++] = c;
+				break;
+			case Status::Incomplete:
+				if (!final)
+				{
+					consumed = i;
+					return o;
+				}
+				[[fallthrough]];
+			case Status::Invalid:
+				if (mode == UTF8::Mode::Strict)
+					invalidInput(offset + i);
+				out[o++] = UTF8::replacement;
+				break;
+		}
+		i += length;
+	}
+	consumed = i;
+	return o;
+}
+
+std::size_t UTF8::Decode(std::string_view in, Char* out, Mode mode)
+{
+	std::size_t consumed;
+	return decode(reinterpret_cast<const unsigned char*>(in.data()), in.size(), out, mode, true, consumed, 0);
+}
+
+String UTF8::Decode(std::string_view in, Mode mode)
+{
+	String s(in.size(), U'\0');
+	s.resize(Decode(in, s.data(), mode));
+	return s;
+}
+
+std::size_t UTF8::Encode(StringView in, char* out, Mode mode)
+{
+	const EncodeASCIIFn ascii = encodeASCII();
+	unsigned char* bytes = reinterpret_cast<unsigned char*>(out);
+	const std::size_t size = in.size();
+	std::size_t i = 0;
+	std::size_t o = 0;
+	while (i < size)
+	{
+		Char c = in[i];
+		if (c < 0x80)
+		{
+			const std::size_t run = ascii(in.data() + i, size - i, bytes + o);
+			i += run;
+			o += run;
+			while (i < size && in[i] < 0x80)
+				bytes[o++] = static_cast<unsigned char>(in[i++]);
+			continue;
+		}
+
+		if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+		{
+			if (mode == Mode::Strict)
+			{
+				char hex[8];
+				char* end = std::to_chars(hex, hex + sizeof(hex), static_cast<std::uint32_t>(c), 16).ptr;
+				throw Util::Exception("Invalid codepoint 0x" + std::string(hex, end) + " at index " + std::to_string(i));
+			}
+			c = replacement;
+		}
+
+		if (c < 0x800)
+		{
+			bytes[o++] = static_cast<unsigned char>(0xC0 | (c >> 6));
+			bytes[o++] = static_cast<unsigned char>(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			bytes[o++] = static_cast<unsigned char>(0xE0 | (c >> 12));
+			bytes[o++] = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3F));
+			bytes[o++] = static_cast<unsigned char>(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			bytes[o++] = static_cast<unsigned char>(0xF0 | (c >> 18));
+			bytes[o++] = static_cast<unsigned char>(0x80 | ((c >> 12) & 0x3F));
+			bytes[o++] = static_cast<unsigned char>(0x80 | ((c >> 6) & 0x3F));
+			bytes[o++] = static_cast<unsigned char>(0x80 | (c & 0x3F));
+		}
+		++i;
+	}
+	return o;
+}
+
+std::string UTF8::Encode(StringView in, Mode mode)
+{
+	std::string s(4 * in.size(), '\0');
+	s.resize(Encode(in, s.data(), mode));
+	return s;
+}
+
+UTF8::Decoder::Decoder(Mode mode):
+	m_mode(mode)
+{
+}
+
+void UTF8::Decoder::Decode(std::string_view in, String& out)
+{
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in.data());
+	std::size_t size = in.size();
+	const std::size_t start = out.size();
+	// The pending sequence gives at most one more codepoint
+	out.resize(start + size + 1);
+	std::size_t o = start;
+
+	// In Strict mode, the caller's string is left as it was when the input is invalid
+	try
+	{
+		if (m_pendingSize != 0)
+		{
+			unsigned char seq[4];
+			std::memcpy(seq, m_pending.data(), m_pendingSize);
+			const std::size_t taken = std::min(4 - m_pendingSize, size);
+			std::memcpy(seq + m_pendingSize, bytes, taken);
+
+			Char c;
+			std::size_t length;
+			const Status status = decodeSequence(seq, m_pendingSize + taken, c, length);
+			if (status == Status::Incomplete)
+			{
+				std::memcpy(m_pending.data() + m_pendingSize, bytes, taken);
+				m_pendingSize += taken;
+				out.resize(start);
+				return;
+			}
+			if (status == Status::Valid)
+				out[o++] = c;
+			else
+			{
+				if (m_mode == Mode::Strict)
+					invalidInput(m_offset + length);
+				out[o++] = replacement;
+			}
+
+			// The pending bytes are a valid start, the sequence ends in this chunk
+			const std::size_t used = length - m_pendingSize;
+			bytes += used;
+			size -= used;
+			m_offset += length;
+			m_pendingSize = 0;
+		}
+
+		std::size_t consumed;
+		o += decode(bytes, size, out.data() + o, m_mode, false, consumed, m_offset);
+		m_offset += consumed;
+		m_pendingSize = size - consumed;
+		std::memcpy(m_pending.data(), bytes + consumed, m_pendingSize);
+		out.resize(o);
+	}
+	catch (...)
+	{
+		out.resize(start);
+		m_pendingSize = 0;
+		throw;
+	}
+}
+
+void UTF8::Decoder::Finish(String& out)
+{
+	if (m_pendingSize != 0)
+	{
+		if (m_mode == Mode::Strict)
+			invalidInput(m_offset);
+		out.push_back(replacement);
+	}
+	m_pendingSize = 0;
+	m_offset = 0;
+}
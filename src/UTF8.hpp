@@ -0,0 +1,128 @@
+#ifndef TERMBOXWIDGETS_UTF8_HPP
+#define TERMBOXWIDGETS_UTF8_HPP
+
+#include "Util.hpp"
+#include <string_view>
+#include <array>
+
+////////////////////////////////////////////////
+/// \brief UTF-8 conversion
+///
+/// Conversions validate their input: overlong forms, surrogates and
+/// codepoints past U+10FFFF are invalid. Runs of ASCII are converted
+/// with SIMD (AVX2 when the CPU supports it).
+/// \code{.cpp}
+/// // Data read in chunks, sequences may be split between them
+/// UTF8::Decoder decoder(UTF8::Mode::Lossy);
+/// String text;
+/// while (read(fd, buf, sizeof(buf)) > 0)
+/// 	decoder.Decode(std::string_view(buf, n), text);
+/// decoder.Finish(text);
+/// \endcode
+/// \see Util::StringConvert
+/// \ingroup Records
+////////////////////////////////////////////////
+namespace UTF8
+{
+/** @cond */
+MAKE_CENUM_Q(Mode, std::uint8_t,
+	Strict, 0, ///< Invalid input throws Util::Exception
+	Lossy,  1  ///< Invalid input is replaced by U+FFFD
+);
+/** @endcond */
+
+////////////////////////////////////////////////
+/// \brief Character that replaces invalid input in Lossy mode
+////////////////////////////////////////////////
+constexpr Char replacement = 0xFFFD;
+
+////////////////////////////////////////////////
+/// \brief Convert UTF-8 to UTF-32
+///
+/// \param in The UTF-8 bytes
+/// \param out The codepoints, must hold in.size() codepoints
+/// \param mode What to do with invalid input. In Lossy mode, every maximal
+///  part of an invalid sequence is replaced by one U+FFFD.
+/// \returns The number of codepoints written
+/// \throws Util::Exception with Mode::Strict, if the input is invalid
+////////////////////////////////////////////////
+std::size_t Decode(std::string_view in, Char* out, Mode mode = Mode::Strict);
+
+////////////////////////////////////////////////
+/// \brief Convert UTF-8 to UTF-32
+///
+/// \param in The UTF-8 bytes
+/// \param mode What to do with invalid input
+/// \returns The codepoints
+/// \throws Util::Exception with Mode::Strict, if the input is invalid
+////////////////////////////////////////////////
+String Decode(std::string_view in, Mode mode = Mode::Strict);
+
+////////////////////////////////////////////////
+/// \brief Convert UTF-32 to UTF-8
+///
+/// Codepoints do not depend on each other, a string may be
+/// converted in as many chunks as needed.
+/// \param in The codepoints
+/// \param out The UTF-8 bytes, must hold 4 * in.size() bytes
+/// \param mode What to do with surrogates and values past U+10FFFF
+/// \returns The number of bytes written
+/// \throws Util::Exception with Mode::Strict, if the input is invalid
+////////////////////////////////////////////////
+std::size_t Encode(StringView in, char* out, Mode mode = Mode::Strict);
+
+////////////////////////////////////////////////
+/// \brief Convert UTF-32 to UTF-8
+///
+/// \param in The codepoints
+/// \param mode What to do with surrogates and values past U+10FFFF
+/// \returns The UTF-8 bytes
+/// \throws Util::Exception with Mode::Strict, if the input is invalid
+////////////////////////////////////////////////
+std::string Encode(StringView in, Mode mode = Mode::Strict);
+
+////////////////////////////////////////////////
+/// \brief Convert UTF-8 to UTF-32 in chunks
+///
+/// Sequences split between two chunks are kept until the
+/// next chunk completes them.
+////////////////////////////////////////////////
+class Decoder
+{
+	Mode m_mode;
+	std::array<char, 4> m_pending; ///< Start of a sequence, not complete yet
+	std::size_t m_pendingSize = 0;
+	std::size_t m_offset = 0; ///< Number of bytes consumed, for errors
+
+public:
+	////////////////////////////////////////////////
+	/// \brief Constructor
+	///
+	/// \param mode What to do with invalid input
+	////////////////////////////////////////////////
+	explicit Decoder(Mode mode = Mode::Strict);
+
+	////////////////////////////////////////////////
+	/// \brief Convert a chunk
+	///
+	/// \param in The next UTF-8 bytes
+	/// \param out The string the codepoints are appended to
+	/// \throws Util::Exception with Mode::Strict, if the input is invalid.
+	///  out is left unchanged, and the pending sequence is dropped.
+	////////////////////////////////////////////////
+	void Decode(std::string_view in, String& out);
+
+	////////////////////////////////////////////////
+	/// \brief Signal the end of the input
+	///
+	/// \param out The string U+FFFD is appended to, if the
+	///  input ends with an incomplete sequence in Lossy mode
+	/// \throws Util::Exception with Mode::Strict, if the input
+	///  ends with an incomplete sequence
+	/// \note The decoder can be used again afterwards
+	////////////////////////////////////////////////
+	void Finish(String& out);
+};
+} // UTF8
+
+#endif // TERMBOXWIDGETS_UTF8_HPP
@@ -1,9 +1,27 @@
 #include "Util.hpp"
+#include "Grapheme.hpp"
+#include "UTF8.hpp"
 
 int Util::SizeWide(const String& s)
 {
 	int sz = 0;
-	for (const auto& c : s)
-		sz += wcwidth(c);
+	for (std::size_t i = 0; i < s.size();)
+	{
+		const std::size_t j = Grapheme::Next(s, i);
+		sz += Grapheme::Width(StringView(s).substr(i, j - i));
+		i = j;
+	}
 	return sz;
 }
+
+template <>
+String Util::StringConvert<Char, char>(const std::string& s)
+{
+	return UTF8::Decode(s);
+}
+
+template <>
+std::string Util::StringConvert<char, Char>(const String& s)
+{
+	return UTF8::Encode(s);
+}
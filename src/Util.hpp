@@ -136,6 +136,13 @@ constexpr std::array<T, sizeof...(Ts) + 1> make_array(T t, Ts... ts);
 template <typename T, typename U>
 std::basic_string<T> StringConvert(const std::basic_string<U>& s);
 
+/** @cond */
+template <>
+String StringConvert<Char, char>(const std::string& s);
+template <>
+std::string StringConvert<char, Char>(const String& s);
+/** @endcond */
+
 ////////////////////////////////////////////////
 /// \brief Strlen for any type of strings
 ///
@@ -1,7 +1,6 @@
 #include "Util.hpp"
 
-#include <codecvt>
-#include <locale>
+#include <bit>
 
 template <typename T, typename ... Ts>
 constexpr std::array<T, sizeof...(Ts)+1> Util::make_array(T t, Ts... ts)
@@ -23,23 +22,7 @@ std::basic_string<T> Util::StringConvert(const std::basic_string<U>& s)
 	if constexpr (std::is_same_v<T, U>)
 		return s;
 
-	if constexpr (std::is_same_v<T, Char>)
-	{
-		if constexpr (std::is_same_v<U, char>)
-		{
-			std::wstring_convert<std::codecvt_utf8<Char>, Char> conv;
-			return conv.from_bytes(s);
-		}
-	}
-	else if constexpr (std::is_same_v<T, char>)
-	{
-		if constexpr (std::is_same_v<U, Char>)
-		{
-			std::wstring_convert<std::codecvt_utf8<Char>, Char> conv;
-			return conv.to_bytes(s);
-		}
-	}
-	else if constexpr (std::is_same_v<T, wchar_t>)
+	if constexpr (std::is_same_v<T, wchar_t>)
 	{
 		if constexpr (std::is_same_v<U, Char>)
 		{
@@ -104,17 +87,48 @@ std::vector<std::basic_string<T>> Util::Split(const std::basic_string<T>& s, con
 template <std::size_t B, class T>
 std::uint8_t Util::GetDigitsNum(T x)
 {
-	if (x == T(B))
-		return 2;
-	if (x < T(0))
-		return 0;
-	if (x < T(B))
-		return 1;
-	
-	static constexpr double log_b = std::log(B);
-	
-	//TODO: use log10i & log2i
-	return 1+std::log(x)/log_b;
+	static_assert(B >= 2);
+	if constexpr (std::is_signed_v<T>)
+	{
+		if (x < T(0))
+			return 0;
+	}
+
+	using U = std::make_unsigned_t<T>;
+	constexpr int bits = std::numeric_limits<U>::digits;
+	// A number of n bits has either as many digits as 2^(n-1), or one more
+	// digits[n] is the number of digits of 2^(n-1), powers[d] is B^d (0 past the largest)
+	static constexpr auto tables = []
+	{
+		std::array<std::uint8_t, bits + 1> digits{};
+		std::array<U, bits + 2> powers{};
+		digits[0] = 1;
+		for (int n = 1; n <= bits; ++n)
+		{
+			U v = U(1) << (n - 1);
+			std::uint8_t d = 1;
+			while (v >= B)
+			{
+				v /= B;
+				++d;
+			}
+			digits[n] = d;
+		}
+		U p = 1;
+		for (std::size_t d = 0; d < powers.size(); ++d)
+		{
+			powers[d] = p;
+			if (p > std::numeric_limits<U>::max() / B)
+				break;
+			p *= B;
+		}
+		return std::make_pair(digits, powers);
+	}();
+
+	const U u = static_cast<U>(x);
+	const std::uint8_t d = tables.first[std::bit_width(u)];
+	const U next = tables.second[d];
+	return d + (next != 0 && u >= next);
 }
 
 template <std::size_t B, class T>
@@ -1,6 +1,8 @@
 #include "Widgets.hpp"
 #include "Draw.hpp"
 #include "Window.hpp"
+#include "Cells.hpp"
+#include <algorithm>
 
 // {{{ BorderItem
 BorderItem::BorderItem()
@@ -16,14 +18,17 @@ std::pair<Vec2i, Vec2i> BorderItem::Draw(Vec2i pos, Vec2i size) const
 	// Remove wide characters
 	if (m_fixDoubleWide)
 	{
-		static constexpr auto charFn = [](const struct tb_cell& cell, Vec2i pos) -> struct tb_cell
+		for (int j = 0; j <= size[1]; ++j)
 		{
-			if (wcwidth(cell.ch) != 1)
-				return { Settings::trailing_character, cell.fg, cell.bg };
-
-			return cell;
-		};
-		Draw::Vertical(charFn, pos - Vec2i(1, 0), size[1] + 1);
+			if (!Draw::IsContinuation(pos + Vec2i(0, j)))
+				continue;
+
+			auto [row, off] = Draw::Row(pos + Vec2i(-1, j), 1);
+			if (row.empty())
+				continue;
+			row[0].ch = Settings::trailing_character;
+			Draw::MarkWide(row);
+		}
 	}
 	//TODO: Maybe fix triple wide?
 
@@ -101,12 +106,20 @@ Widget::Widget(Window* parent):
 	m_active(true),
 	m_pos(0, 0),
 	m_size(0, 0),
+	m_retained(false),
+	m_surfaceExpired(true),
+	m_saveUnder(false),
+	m_underSaved(false),
+	m_underPos(0, 0),
+	m_underClip(Vec2i(0, 0), Vec2i(0, 0)),
 	m_trailingChar(Settings::trailing_character, Settings::default_text_style)
 {
 }
 
 Widget::~Widget()
 {
+	if (m_underSaved)
+		Draw::Unwatch(m_underDamage.data());
 }
 
 void Widget::SetPosition(Vec2i pos)
@@ -143,6 +156,11 @@ const Vec2i& Widget::GetSize() const
 	return m_size;
 }
 
+std::pair<Vec2i, Vec2i> Widget::GetBounds() const
+{
+	return { m_pos - Vec2i(1, 0), m_size + Vec2i(2, 1) };
+}
+
 bool Widget::IsCorrect() const
 {
 	if (!m_parent)
@@ -164,6 +182,8 @@ bool Widget::IsCorrect() const
 void Widget::SetVisible(bool v)
 {
 	OnSetVisible.Notify<EventWhen::BEFORE>(v);
+	if (!v && m_visible)
+		RestoreUnder();
 	m_visible = v;
 	OnSetVisible.Notify<EventWhen::AFTER>(v);
 }
@@ -203,6 +223,136 @@ bool Widget::IsProcessingTimed() const
 {
 	return EventsRunning();
 }
+
+void Widget::SetRetained(bool v)
+{
+	m_retained = v;
+	m_surfaceExpired = true;
+	if (!v)
+	{
+		m_surface = CellSurface();
+		m_surfaceDrawn.clear();
+	}
+}
+
+bool Widget::IsRetained() const
+{
+	return m_retained;
+}
+
+void Widget::Invalidate()
+{
+	m_surfaceExpired = true;
+}
+
+void Widget::SetSaveUnder(bool v)
+{
+	m_saveUnder = v;
+	if (!v)
+	{
+		if (m_underSaved)
+			Draw::Unwatch(m_underDamage.data());
+		m_underSaved = false;
+		m_under = CellSurface();
+		m_underDamage.clear();
+	}
+}
+
+bool Widget::IsSaveUnder() const
+{
+	return m_saveUnder;
+}
+
+void Widget::RestoreUnder()
+{
+	if (!m_underSaved)
+		return;
+
+	// Saved positions are on the screen, this may be called outside of Draw()
+	Draw::Unwatch(m_underDamage.data());
+	const Vec2i screen = Draw::ToScreen(Vec2i(0, 0));
+	Draw::PushClip(m_underClip.first - screen, m_underClip.second);
+	Draw::Blit(m_under, m_underPos - screen);
+	Draw::PopClip();
+	m_underSaved = false;
+
+	// Retained parents still hold the widget in their surface
+	for (Widget* parent = (Widget*)m_parent; parent; parent = (Widget*)parent->m_parent)
+	{
+		if (parent->m_retained)
+			parent->Invalidate();
+	}
+}
+
+bool Widget::UpdateSaveUnder()
+{
+	if (!m_underSaved)
+		return false;
+
+	if (std::none_of(m_underDamage.begin(), m_underDamage.end(), [](std::uint64_t word) { return word != 0; }))
+		return false;
+
+	Draw::Capture(m_under, m_underPos - Draw::ToScreen(Vec2i(0, 0)), m_underDamage.data());
+	std::fill(m_underDamage.begin(), m_underDamage.end(), 0);
+	Invalidate();
+	return true;
+}
+
+void Widget::Render(bool expired)
+{
+	const auto [pos, size] = GetBounds();
+	if (m_saveUnder)
+	{
+		// The widget's own cells are not under it
+		if (m_underSaved)
+			Draw::Unwatch(m_underDamage.data());
+
+		// The widget has moved or was resized
+		if (m_underSaved && (m_underPos != Draw::ToScreen(pos) || m_under.GetSize() != size))
+			RestoreUnder();
+
+		if (!m_underSaved)
+		{
+			m_under.Resize(size);
+			Draw::Capture(m_under, pos);
+			m_underPos = Draw::ToScreen(pos);
+			const auto clip = Draw::GetClip();
+			m_underClip = { Draw::ToScreen(clip.first), clip.second };
+			m_underDamage.assign(Cells::BitmapWords(size[0]) * size[1], 0);
+			m_underSaved = true;
+		}
+	}
+
+	if (!m_retained)
+		Draw();
+	else
+	{
+		if (expired || m_surfaceExpired || m_surface.GetSize() != size)
+		{
+			if (m_surface.GetSize() != size)
+			{
+				m_surface.Resize(size);
+				Invalidate();
+			}
+
+			// The widget draws over what is on the target, only the cells it wrote are copied back
+			Draw::Capture(m_surface, pos);
+			m_surfaceDrawn.assign(Cells::BitmapWords(size[0]) * size[1], 0);
+			Draw::PushTarget(m_surface, pos);
+			Draw::Watch(m_surfaceDrawn.data(), pos, size);
+			Draw();
+			Draw::Unwatch(m_surfaceDrawn.data());
+			Draw::PopTarget();
+			m_surfaceExpired = false;
+		}
+
+		Draw::Blit(m_surface, pos, m_surfaceDrawn.data());
+	}
+
+	// Cells written from now on are under the widget
+	if (m_saveUnder)
+		Draw::Watch(m_underDamage.data(), pos, size);
+}
 // }}}
 
 // {{{ TextLine
@@ -224,6 +374,11 @@ void Widgets::TextLine::SetLine(const TBString& line)
 	m_line = line;
 }
 
+void Widgets::TextLine::SetLine(TBString&& line)
+{
+	m_line = std::move(line);
+}
+
 const TBString& Widgets::TextLine::GetLine() const
 {
 	return m_line;
@@ -259,12 +414,17 @@ Widgets::Button::Button(Window* win, const TBString& text)
 
 void Widgets::Button::SetText(const TBString& text)
 {
-	m_text = text;
+	m_text.SetText(text);
+}
+
+void Widgets::Button::SetText(TBString&& text)
+{
+	m_text.SetText(std::move(text));
 }
 
 const TBString& Widgets::Button::GetText() const
 {
-	return m_text;
+	return m_text.GetText();
 }
 
 void Widgets::Button::SetBackground(const TBChar& bg)
@@ -283,13 +443,13 @@ void Widgets::InputLine::Draw()
 	// Debug
 	if constexpr (true)
 	{
-		auto p = Draw::TextLine( Util::StringConvert<Char>(std::to_string(m_position)),  m_textStyle, {1,1}, 10, m_trailingChar).first;
+		auto p = Draw::Format({1,1}, 10, m_textStyle, U"{}", m_position);
 		Draw::Horizontal(m_bg, Vec2i(1,1) + Vec2i(p, 0), 10 - p);
-		p = Draw::TextLine( Util::StringConvert<Char>(std::to_string(m_cursor)),  m_textStyle, {1,2}, 10, m_trailingChar).first;
+		p = Draw::Format({1,2}, 10, m_textStyle, U"{}", m_cursor);
 		Draw::Horizontal(m_bg, Vec2i(1,2) + Vec2i(p, 0), 10 - p);
-		p = Draw::TextLine( Util::StringConvert<Char>(std::to_string(m_textOffset)),  m_textStyle, {1,3}, 10, m_trailingChar).first;
+		p = Draw::Format({1,3}, 10, m_textStyle, U"{}", m_textOffset);
 		Draw::Horizontal(m_bg, Vec2i(1,3) + Vec2i(p, 0), 10 - p);
-		p = Draw::TextLine( Util::StringConvert<Char>(std::to_string(m_leftScroll)),  m_textStyle, {1,4}, 10, m_trailingChar).first;
+		p = Draw::Format({1,4}, 10, m_textStyle, U"{}", m_leftScroll);
 		Draw::Horizontal(m_bg, Vec2i(1,4) + Vec2i(p, 0), 10 - p);
 	}
 
@@ -298,7 +458,7 @@ void Widgets::InputLine::Draw()
 	const auto p = Draw::TextLine(m_text, m_textStyle, GetPosition()+Vec2i(m_leftScroll, 0), GetSize()[0]-m_leftScroll, m_trailingChar, m_textOffset).first;
 	Draw::Horizontal(m_bg, GetPosition() + Vec2i(p+m_leftScroll, 0), GetSize()[0] - p - m_leftScroll);
 
-	Termbox::SetCursor(GetPosition() + Vec2i(static_cast<int>(m_cursor), 0));
+	Termbox::SetCursor(Draw::ToScreen(GetPosition() + Vec2i(static_cast<int>(m_cursor), 0)));
 }
 
 Widgets::InputLine::InputLine(const String& text, std::size_t position)
@@ -2,6 +2,7 @@
 #define TERMBOXWIDGETS_WIDGETS_HPP
 
 #include "Draw.hpp"
+#include "Surface.hpp"
 #include "Termbox.hpp"
 #include <deque>
 class Window;
@@ -88,6 +89,20 @@ class Widget : public Drawable, public KeyboardInput, public MouseInput, public
 
 	Vec2i m_pos;
 	Vec2i m_size;
+
+	bool m_retained;
+	bool m_surfaceExpired;
+	CellSurface m_surface;
+	std::vector<std::uint64_t> m_surfaceDrawn; // Cells of m_surface the widget wrote, see Draw::Watch
+
+	bool m_saveUnder;
+	bool m_underSaved;
+	Vec2i m_underPos; // On the screen
+	std::pair<Vec2i, Vec2i> m_underClip; // On the screen
+	CellSurface m_under; // Cells covered by the widget
+	std::vector<std::uint64_t> m_underDamage; // Cells of m_under written since the widget was drawn, see Draw::Watch
+
+	void RestoreUnder();
 protected:
 	TBChar m_trailingChar;
 
@@ -121,6 +136,15 @@ public:
 	Vec2i& GetSize();
 	const Vec2i& GetSize() const;
 
+	////////////////////////////////////////////////
+	/// \brief Get the cells the widget may draw to
+	///
+	/// Borders are drawn one cell past the size, and BorderItem
+	/// replaces wide characters on the column left of the widget.
+	/// \return The position and size of the rectangle
+	////////////////////////////////////////////////
+	std::pair<Vec2i, Vec2i> GetBounds() const;
+
 	////////////////////////////////////////////////
 	/// \brief Determines if the widget can fit on the window
 	/// \return true if the widget can correctly fit on the window
@@ -169,6 +193,69 @@ public:
 	////////////////////////////////////////////////
 	bool IsProcessingTimed() const;
 
+	////////////////////////////////////////////////
+	/// \brief Set the widget to retained mode
+	///
+	/// A retained widget draws itself into its own surface, only
+	/// when its content has changed. Every other time it has to be
+	/// drawn (e.g its window was invalidated, or the screen resized),
+	/// the surface is copied to the screen.
+	/// \param v The value
+	/// \note A retained widget may only draw inside of its bounds (see GetBounds)
+	/// \see Render
+	////////////////////////////////////////////////
+	void SetRetained(bool v);
+
+	////////////////////////////////////////////////
+	/// \brief Returns wether or not the widget is retained
+	/// \returns True if the widget is in retained mode
+	////////////////////////////////////////////////
+	bool IsRetained() const;
+
+	////////////////////////////////////////////////
+	/// \brief Invalidate the widget, marking it for complete redrawing
+	///
+	/// In retained mode, the widget will be redrawn into its surface the
+	/// next time it is rendered. Use this when the content is modified
+	/// outside of an input event (e.g by a timed event)
+	////////////////////////////////////////////////
+	virtual void Invalidate();
+
+	////////////////////////////////////////////////
+	/// \brief Set the widget to save the cells it covers
+	///
+	/// When it is first drawn, the widget saves the cells it covers and
+	/// restores them when it is hidden (see SetVisible), so that closing a
+	/// popup does not require redrawing what is under it. Retained
+	/// parents are invalidated, their surface still holds the widget.
+	/// \param v The value
+	/// \note The widget has to be drawn after the widgets it covers
+	////////////////////////////////////////////////
+	void SetSaveUnder(bool v);
+
+	////////////////////////////////////////////////
+	/// \brief Returns wether or not the widget saves the cells it covers
+	/// \returns True if the widget saves the cells it covers
+	////////////////////////////////////////////////
+	bool IsSaveUnder() const;
+
+	////////////////////////////////////////////////
+	/// \brief Record the cells that were redrawn under the widget
+	///
+	/// Must be called after widgets under this one were drawn, and before
+	/// this one is drawn again. Cells written under the widget since it
+	/// was last drawn (see Draw::Watch) will be restored instead of the
+	/// saved ones, and the widget is invalidated.
+	/// \returns True if cells were rewritten under the widget
+	////////////////////////////////////////////////
+	bool UpdateSaveUnder();
+
+	////////////////////////////////////////////////
+	/// \brief Draw the widget, through its surface in retained mode
+	/// \param expired True if the widget's content has changed
+	////////////////////////////////////////////////
+	void Render(bool expired);
+
 	void Resize(Vec2i dim) { }
 };
 // }}}
@@ -200,6 +287,7 @@ public:
 	/// \param line The new textline
 	////////////////////////////////////////////////
 	void SetLine(const TBString& line);
+	void SetLine(TBString&& line);
 
 	////////////////////////////////////////////////
 	/// \brief Get the line
@@ -223,7 +311,7 @@ public:
 // {{{ Button
 class Button : public Widget, public BorderItem
 {
-	TBString m_text;
+	TextWrap m_text; ///< Wrapped again only when the button is resized
 	TBChar m_bg;
 
 	virtual void Draw();
@@ -232,6 +320,7 @@ public:
 	Button(Window* win, const TBString& text);
 
 	void SetText(const TBString& text);
+	void SetText(TBString&& text);
 	const TBString& GetText() const;
 
 	void SetBackground(const TBChar& bg);
@@ -401,6 +490,7 @@ class ListSelect : public Widget
 
 	std::size_t m_position;
 	std::size_t m_offset;
+	std::size_t m_drawnOffset; // Offset when last drawn
 
 	TBChar m_bg;
 
@@ -411,6 +501,13 @@ public:
 	{
 		OnDraw.Notify<EventWhen::BEFORE>();
 
+		// Rows that remain visible can be scrolled by the terminal
+		if (m_drawnOffset != m_offset)
+		{
+			Termbox::Scroll(Draw::ToScreen(GetPosition()), GetSize(), static_cast<int>(m_offset - m_drawnOffset));
+			m_drawnOffset = m_offset;
+		}
+
 		int numberWidth = 0; // Width for numbers
 		if constexpr (Settings.DrawNumbers)
 		{
@@ -448,32 +545,34 @@ public:
 			// Draw the numbers...
 			if constexpr (Settings.DrawNumbers)
 			{
-				String s;
+				static_assert(Settings.NumberBase == 2 || Settings.NumberBase == 8 || Settings.NumberBase == 10 || Settings.NumberBase == 16,
+					"Numbers can only be drawn in base 2, 8, 10 or 16");
+				constexpr StringView format = Settings.NumberBase == 2 ? U"{:b}"
+					: Settings.NumberBase == 8 ? U"{:o}"
+					: Settings.NumberBase == 16 ? U"{:X}"
+					: U"{}";
+
+				std::size_t n = m_offset+static_cast<std::size_t>(y);
 				if constexpr (Settings.RelativeNumbers)
 				{
-					if (m_offset+static_cast<std::size_t>(y) == m_position) [[unlikely]]
-						s = Util::ToString<Settings.NumberBase>(m_offset+static_cast<std::size_t>(y));
-					else [[likely]]
+					if (n != m_position) [[likely]]
 					{
 						if (m_position-m_offset < static_cast<std::size_t>(y))
-							s = Util::ToString<Settings.NumberBase>(static_cast<std::size_t>(y) - m_position+m_offset);
+							n = static_cast<std::size_t>(y) - m_position+m_offset;
 						else
-							s = Util::ToString<Settings.NumberBase>(m_position-m_offset-static_cast<std::size_t>(y));
+							n = m_position-m_offset-static_cast<std::size_t>(y);
 					}
 				}
-				else
-				{
-					String s = Util::ToString<Settings.NumberBase>(m_offset+static_cast<std::size_t>(y));
-				}
 
 				if constexpr (Settings.NumberRightAlign)
 				{
-					const auto p = Draw::TextLine(s, s2, GetPosition()+Vec2i(Settings.LeftMargin+numberWidth-static_cast<int>(s.size()), y), s.size(), {Settings.TrailingChar, s2}).first;
-					Draw::Horizontal({m_bg.ch, s2}, GetPosition()+Vec2i(Settings.LeftMargin, y), numberWidth-p);
+					const int pad = std::max(numberWidth-Util::GetDigitsNum<Settings.NumberBase>(n), 0);
+					Draw::Horizontal({m_bg.ch, s2}, GetPosition()+Vec2i(Settings.LeftMargin, y), pad);
+					Draw::Format(GetPosition()+Vec2i(Settings.LeftMargin+pad, y), numberWidth-pad, s2, format, n);
 				}
 				else
 				{
-					const auto p = Draw::TextLine(s, s2, GetPosition()+Vec2i(Settings.LeftMargin, y), numberWidth, {Settings.TrailingChar, s2}).first;
+					const int p = Draw::Format(GetPosition()+Vec2i(Settings.LeftMargin, y), numberWidth, s2, format, n);
 					Draw::Horizontal({m_bg.ch, s2}, GetPosition()+Vec2i(Settings.LeftMargin+p, y), numberWidth-p);
 				}
 			}
@@ -629,6 +728,7 @@ public:
 		m_entries(0),
 		m_position(0),
 		m_offset(0),
+		m_drawnOffset(0),
 		m_bg(U' ', Settings::default_text_style)
 	{
 	}
@@ -60,20 +60,26 @@ void Window::Draw()
 		Draw::Rectangle(m_bg, m_ipos, m_isize);
 	}
 
-	// Widgets
+	// Widgets, they may not draw over the border or outside of the window
+	// and their positions are relative to the window's interior
+	m_gpos = Draw::ToScreen(m_ipos);
+	Draw::PushClip(m_ipos, m_isize);
+	Draw::PushTranslation(m_ipos);
+	bool drawn = m_invalidate;
 	for (auto& it : m_widgets)
 	{
 		if (!it.first->IsVisible())
 			continue;
-		if (!m_invalidate && !it.second)
+		const bool under = drawn && it.first->IsSaveUnder() && it.first->UpdateSaveUnder();
+		if (!m_invalidate && !it.second && !under)
 			continue;
 
-		auto wPos = it.first->GetPosition();
-		it.first->SetPosition(wPos + m_ipos);
-		it.first->Draw();
-		it.first->SetPosition(wPos);
+		it.first->Render(it.second);
+		drawn = true;
 		it.second = false;
 	}
+	Draw::PopTranslation();
+	Draw::PopClip();
 
 	m_invalidate = false;
 }
@@ -123,7 +129,8 @@ Window::Window(const TBString& windowName, Window* parent):
 	m_bg(Settings::fill_character, { COLOR_DEFAULT, COLOR_DEFAULT, TextStyle::None }),
 	m_invalidate(true),
 	m_ipos(0, 0),
-	m_isize(0, 0)
+	m_isize(0, 0),
+	m_gpos(0, 0)
 {
 	GetPosition() = { 0, 0 };
 	GetSize() = { 0, 0 };
@@ -140,6 +147,11 @@ void Window::SetName(const TBString& name)
 	m_windowName = name;
 }
 
+void Window::SetName(TBString&& name)
+{
+	m_windowName = std::move(name);
+}
+
 const TBString& Window::GetName() const
 {
 	return m_windowName;
@@ -181,20 +193,24 @@ bool Window::CheckAllWidgets() const
 
 std::pair<Vec2i, Vec2i> Window::GetGlboalBounds() const
 {
-	return {m_ipos, m_isize};
+	return {m_gpos, m_isize};
 }
 
 void Window::ReDraw(Widget* widget) const
 {
-	auto wPos = widget->GetPosition();
-	widget->SetPosition(wPos + m_ipos);
-	widget->Draw();
-	widget->SetPosition(wPos);
+	// May be called outside of Draw(), the window's parents are not translated
+	const Vec2i pos = m_gpos - Draw::ToScreen(Vec2i(0, 0));
+	Draw::PushClip(pos, m_isize);
+	Draw::PushTranslation(pos);
+	widget->Render(true);
+	Draw::PopTranslation();
+	Draw::PopClip();
 }
 
 void Window::Invalidate()
 {
 	m_invalidate = true;
+	Widget::Invalidate();
 }
 
 std::vector<std::pair<Widget*, bool>> Window::SetAllInactive()
@@ -18,6 +18,7 @@ class Window : public Widget, public BorderItem
 
 	Vec2i m_ipos;
 	Vec2i m_isize;
+	Vec2i m_gpos; // Interior's position on the screen
 
 	virtual void Draw();
 	virtual std::pair<bool, bool> ProcessKeyboardEvent(Termbox& tb);
@@ -81,6 +82,7 @@ public:
 	/// \see TBString
 	////////////////////////////////////////////////
 	void SetName(const TBString& name);
+	void SetName(TBString&& name);
 	////////////////////////////////////////////////
 	/// \brief Get the window's name
 	/// \returns A const reference to the window's name
@@ -121,7 +123,7 @@ public:
 	////////////////////////////////////////////////
 	/// \brief Invalidate the window, marking it for complete redrawing
 	////////////////////////////////////////////////
-	void Invalidate();
+	void Invalidate() override;
 
 	////////////////////////////////////////////////
 	/// \brief Set all widgets to inactive
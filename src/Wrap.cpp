@@ -0,0 +1,183 @@
+#include "Wrap.hpp"
+#include <limits>
+
+static bool isSpace(Char c)
+{
+	return c == U' ' || c == U'\t';
+}
+
+// Control characters are measured as zero-width, as Draw::TextLine does
+static int charWidth(Char c)
+{
+	return std::max(Grapheme::Width(c), 0);
+}
+
+void TextWrap::split()
+{
+	m_words.clear();
+	m_paragraphs.clear();
+	m_lines.clear();
+	m_limits.clear();
+	m_width = -1;
+
+	const TBChar* s = m_text.Data();
+	const std::size_t size = m_text.Size();
+	if (size == 0)
+		return;
+
+	std::size_t i = 0;
+	do
+	{
+		std::size_t end = i;
+		while (end < size && s[end].ch != U'\n')
+			++end;
+
+		Paragraph p{ m_words.size(), 0, 0, 0 };
+		// An empty paragraph still has one (empty) word, to give it a line
+		do
+		{
+			Word w{ i, i, i, 0, 0 };
+			// Indentation is kept, only the first word of a paragraph may begin with spaces
+			for (; i < end && isSpace(s[i].ch); ++i)
+				w.width += charWidth(s[i].ch);
+			for (; i < end && !isSpace(s[i].ch); ++i)
+			{
+				const int cw = charWidth(s[i].ch);
+				// Wide characters are words by themselves
+				if (cw == 2 && i != w.beg)
+					break;
+				w.width += cw;
+				if (cw == 2 || (s[i].ch == U'-' && i != w.beg))
+				{
+					++i;
+					break;
+				}
+			}
+			w.end = i;
+			for (; i < end && isSpace(s[i].ch); ++i)
+				w.space += charWidth(s[i].ch);
+			w.next = i;
+			m_words.push_back(w);
+		} while (i < end);
+		p.wordsEnd = m_words.size();
+		m_paragraphs.push_back(p);
+
+		i = end + 1;
+	} while (i <= size);
+}
+
+void TextWrap::wrap(const Paragraph& p, int width)
+{
+	const TBChar* s = m_text.Data();
+	const auto push = [this](const Line& line, int limit)
+	{
+		m_lines.push_back(line);
+		m_limits.push_back(limit);
+	};
+
+	Line line{ 0, 0, 0 };
+	bool empty = true;
+	int space = 0; // Width of the spaces after the line, if it goes on
+	for (std::size_t k = p.words; k < p.wordsEnd; ++k)
+	{
+		const Word& w = m_words[k];
+		if (!empty)
+		{
+			if (line.width + space + w.width <= width)
+			{
+				line.end = w.end;
+				line.width += space + w.width;
+				space = w.space;
+				continue;
+			}
+			push(line, line.width + space + w.width);
+			empty = true;
+		}
+
+		line = { w.beg, w.end, w.width };
+		space = w.space;
+		empty = false;
+		// Too long for any line: broken between clusters, with at least one per line
+		while (line.width > width)
+		{
+			std::size_t i = line.beg;
+			int lineWidth = charWidth(s[i].ch);
+			for (++i; i < w.end && lineWidth + charWidth(s[i].ch) <= width; ++i)
+				lineWidth += charWidth(s[i].ch);
+			if (i == w.end) // A single character wider than the line
+				break;
+			push({ line.beg, i, lineWidth }, lineWidth + charWidth(s[i].ch));
+			line = { i, w.end, line.width - lineWidth };
+		}
+	}
+	push(line, std::numeric_limits<int>::max());
+}
+
+void TextWrap::reflow(int width)
+{
+	std::swap(m_lines, m_oldLines);
+	std::swap(m_limits, m_oldLimits);
+	m_lines.clear();
+	m_limits.clear();
+
+	for (auto& p : m_paragraphs)
+	{
+		// Lines that fit and end at the same break do not change
+		bool same = m_width != -1;
+		for (std::size_t l = p.line; same && l < p.linesEnd; ++l)
+			same = m_oldLines[l].width <= width && width < m_oldLimits[l];
+
+		const std::size_t line = m_lines.size();
+		if (same)
+		{
+			m_lines.insert(m_lines.end(), m_oldLines.begin() + p.line, m_oldLines.begin() + p.linesEnd);
+			m_limits.insert(m_limits.end(), m_oldLimits.begin() + p.line, m_oldLimits.begin() + p.linesEnd);
+		}
+		else
+			wrap(p, width);
+		p.line = line;
+		p.linesEnd = m_lines.size();
+	}
+	m_width = width;
+}
+
+TextWrap::TextWrap()
+{
+	split();
+}
+
+TextWrap::TextWrap(const TBString& text):
+	m_text(text)
+{
+	split();
+}
+
+void TextWrap::SetText(const TBString& text)
+{
+	m_text = text;
+	split();
+}
+
+void TextWrap::SetText(TBString&& text)
+{
+	m_text = std::move(text);
+	split();
+}
+
+const TBString& TextWrap::GetText() const
+{
+	return m_text;
+}
+
+const std::vector<TextWrap::Line>& TextWrap::Lines(int width)
+{
+	width = std::max(width, 1);
+	if (width != m_width)
+		reflow(width);
+	return m_lines;
+}
+
+TBStringView TextWrap::View(const Line& line) const
+{
+	return TBStringView(m_text).Substr(line.beg, line.end - line.beg);
+}
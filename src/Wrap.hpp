@@ -0,0 +1,124 @@
+#ifndef TERMBOXWIDGETS_WRAP_HPP
+#define TERMBOXWIDGETS_WRAP_HPP
+
+#include "Text.hpp"
+#include <vector>
+
+////////////////////////////////////////////////
+/// \brief Text wrapped into lines, with cached line breaks
+///
+/// Lines are broken between words, after hyphens and around wide
+/// characters (CJK). Words that do not fit on a line are broken
+/// between grapheme clusters. Newlines start a new paragraph.
+///
+/// The text is measured once, when it is set: wrapping only works on
+/// words. The lines are kept until the width changes, then only the
+/// paragraphs that wrap differently at the new width are wrapped again.
+/// \code{.cpp}
+/// TextWrap help(text);
+/// for (const auto& line : help.Lines(w))
+/// 	Draw::TextLine(help.View(line), pos + Vec2i(0, y++), w, trailing);
+/// \endcode
+/// \see Draw::TextBox
+/// \ingroup Records
+////////////////////////////////////////////////
+class TextWrap
+{
+public:
+	////////////////////////////////////////////////
+	/// \brief Line of wrapped text
+	////////////////////////////////////////////////
+	struct Line
+	{
+		std::size_t beg; ///< Index of the first character
+		std::size_t end; ///< Index past the last character, spaces ending the line are left out
+		int width; ///< Width of the line, in cells
+	};
+
+private:
+	////////////////////////////////////////////////
+	/// \brief Part of a paragraph that is not broken
+	///
+	/// [beg, end) is drawn, [end, next) are the spaces after it
+	////////////////////////////////////////////////
+	struct Word
+	{
+		std::size_t beg, end, next;
+		int width; ///< Width of [beg, end)
+		int space; ///< Width of [end, next)
+	};
+
+	struct Paragraph
+	{
+		std::size_t words, wordsEnd; ///< Range in m_words
+		std::size_t line, linesEnd; ///< Range in m_lines
+	};
+
+	TBString m_text;
+	std::vector<Word> m_words;
+	std::vector<Paragraph> m_paragraphs;
+	int m_width = -1; ///< Width of m_lines, -1 if not wrapped yet
+
+	std::vector<Line> m_lines;
+	////////////////////////////////////////////////
+	/// \brief Smallest width that changes the break ending each line
+	///
+	/// A paragraph is wrapped the same at width w if every line
+	/// fits in w and w is less than the limit of every line.
+	////////////////////////////////////////////////
+	std::vector<int> m_limits;
+	// Lines of the previous width, kept to reuse their memory
+	std::vector<Line> m_oldLines;
+	std::vector<int> m_oldLimits;
+
+	void split();
+	void wrap(const Paragraph& p, int width);
+	void reflow(int width);
+
+public:
+	////////////////////////////////////////////////
+	/// \brief Default constructor, an empty text
+	////////////////////////////////////////////////
+	TextWrap();
+
+	////////////////////////////////////////////////
+	/// \brief Constructor
+	///
+	/// \param text The text
+	////////////////////////////////////////////////
+	explicit TextWrap(const TBString& text);
+
+	////////////////////////////////////////////////
+	/// \brief Set the text
+	///
+	/// \param text The new text, measured again
+	////////////////////////////////////////////////
+	void SetText(const TBString& text);
+	void SetText(TBString&& text);
+
+	////////////////////////////////////////////////
+	/// \brief Get the text
+	///
+	/// \returns The text
+	////////////////////////////////////////////////
+	const TBString& GetText() const;
+
+	////////////////////////////////////////////////
+	/// \brief Get the lines
+	///
+	/// \param width The maximum width of a line, in cells. A character
+	///  wider than width is put alone on its line.
+	/// \returns The lines, valid until the width or the text changes
+	////////////////////////////////////////////////
+	const std::vector<Line>& Lines(int width);
+
+	////////////////////////////////////////////////
+	/// \brief Get the characters of a line
+	///
+	/// \param line A line of the text
+	/// \returns A view over the characters of the line
+	////////////////////////////////////////////////
+	TBStringView View(const Line& line) const;
+};
+
+#endif // TERMBOXWIDGETS_WRAP_HPP
@@ -2,6 +2,9 @@
 #define TERMBOX_WIDGETS_TESTS_HPP
 
 #include "Input.hpp"
+#include "UTF8.hpp"
+#include "ANSI.hpp"
+#include "Wrap.hpp"
 
 struct Test
 {
@@ -180,7 +183,95 @@ static Test ConversionTest(U"Conversion Test", []() {
 },
 { U"189412574", U"7984718", U"-37818947", U"1527837818947", U"95474529137818947" });
 
-static const auto testList = Util::make_array(KeyCombTest, ConversionTest);
+static Test UTF8Test(U"UTF-8", []() {
+	std::vector<String> r;
+
+	r.push_back(Util::StringConvert<Char>(std::string("h\xC3\xA9llo \xE4\xB8\xAD \xF0\x9F\x98\x80")));
+	r.push_back(Util::StringConvert<Char>(Util::StringConvert<char>(String(U"h\u00E9llo \u4E2D \U0001F600"))));
+	// Truncated sequence, overlong form
+	r.push_back(UTF8::Decode("a\xF0\x9F\x98 b\xE0\x80\xAF", UTF8::Mode::Lossy));
+	// Sequence split between two chunks
+	UTF8::Decoder decoder;
+	String s;
+	decoder.Decode("\xE4\xB8", s);
+	decoder.Decode("\xAD!", s);
+	decoder.Finish(s);
+	r.push_back(s);
+
+	return r;
+},
+{ U"h\u00E9llo \u4E2D \U0001F600", U"h\u00E9llo \u4E2D \U0001F600", U"a\uFFFD b\uFFFD\uFFFD\uFFFD", U"\u4E2D!" });
+
+static Test ANSITest(U"ANSI", []() {
+	std::vector<String> r;
+
+	const TBStyle base(0xAAAAAA, 0, TextStyle::None);
+	ANSI::Parser parser(base);
+	String text;
+	std::vector<ANSI::Span> spans;
+	// Sequences split between chunks, a title and a private sequence that are removed
+	parser.Feed("a\x1b[1;3", text, spans);
+	parser.Feed("8;2;0;0;0mb\x1b]0;title\x07" "c\x1b[?25l\x1b[22;91md\x1b[", text, spans);
+	parser.Feed("0me", text, spans);
+	parser.Finish(text, spans);
+
+	r.push_back(text);
+	for (const auto& span : spans)
+		r.push_back(text.substr(span.beg, span.size) + U" " + Util::StringConvert<Char>(std::to_string(span.style.fg())) + U" " +
+					Util::StringConvert<Char>(std::to_string(static_cast<int>(span.style.s))));
+
+	return r;
+},
+{ U"abcde", U"a 11184810 0", U"bc 1 1", U"d 16711680 0", U"e 11184810 0" });
+
+static Test WrapTest(U"Wrap", []() {
+	std::vector<String> r;
+
+	TextWrap text(TBString(U"The quick brown fox\n  jumps over-the-lazy dog", Settings::default_text_style));
+	// Wrapped, then reflowed to a smaller width
+	for (const int w : { 10, 5 })
+		for (const auto& line : text.Lines(w))
+			r.push_back(text.GetText().Str().substr(line.beg, line.end - line.beg));
+
+	return r;
+},
+{ U"The quick", U"brown fox", U"  jumps", U"over-the-", U"lazy dog",
+  U"The", U"quick", U"brown", U"fox", U"  jum", U"ps", U"over-", U"the-", U"lazy", U"dog" });
+
+static Test GraphemeTest(U"Grapheme pool", []() {
+	std::vector<String> r;
+	const auto collect = []()
+	{
+		// Clusters are kept through two generations
+		for (int i = 0; i < 3; ++i)
+			Grapheme::Collect();
+	};
+	const auto count = [](std::size_t base) { return String(1, U'0' + static_cast<Char>(Grapheme::PoolSize() - base)); };
+
+	collect();
+	const std::size_t base = Grapheme::PoolSize();
+	{
+		TBString kept(U"q\u0307\u0323", Settings::default_text_style);
+		{
+			const TBString dropped(U"x\u0307y\u0307", Settings::default_text_style);
+			r.push_back(count(base));
+		}
+		collect();
+		r.push_back(count(base));
+		r.push_back(kept.Str());
+	}
+	collect();
+	r.push_back(count(base));
+	// Freed indices are reused
+	const TBString again(U"x\u0307", Settings::default_text_style);
+	r.push_back(again.Str());
+	r.push_back(count(base));
+
+	return r;
+},
+{ U"3", U"1", U"q\u0307\u0323", U"0", U"x\u0307", U"1" });
+
+static const auto testList = Util::make_array(KeyCombTest, ConversionTest, UTF8Test, ANSITest, WrapTest, GraphemeTest);
 
 static bool TestAll()
 {